@@ -12,6 +12,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <X11/Xutil.h>
 
 /* composite */
@@ -19,20 +21,23 @@
  #include <X11/extensions/Xcomposite.h>
 #endif
 
-/* event loop */
-#if defined(WITH_EV)
- #include <ev.h>
-#elif defined(WITH_EVENT)
- #include <event.h>
-#else
- #include <sys/timerfd.h>
-#endif
-
 #include "logger.h"
 #include "theme.h"
 #include "render.h"
 #include "version.h"
 #include "bmpanel.h"
+#include "whash.h"
+#include "tasklist.h"
+#include "iconcache.h"
+#include "iconload.h"
+#include "winstate.h"
+#include "clocksched.h"
+#include "reactor.h"
+#include "perf.h"
+#include "trace.h"
+#include "replay.h"
+#include "xprop.h"
+#include "shm.h"
 
 /**************************************************************************
   GLOBALS
@@ -73,7 +78,16 @@ static char *atom_names[] = {
 	"_NET_SYSTEM_TRAY_OPCODE",
 	"UTF8_STRING",
 	"_MOTIF_WM_HINTS",
-	"_XROOTPMAP_ID"
+	"_XROOTPMAP_ID",
+	"_NET_WM_STATE_SKIP_PAGER",
+	"_NET_WM_STATE_DEMANDS_ATTENTION",
+	"_NET_WM_STATE_FULLSCREEN",
+	"_NET_WM_STATE_MAXIMIZED_VERT",
+	"_NET_WM_STATE_MAXIMIZED_HORZ",
+	"_NET_WM_STATE_ABOVE",
+	"_NET_WM_STATE_BELOW",
+	"_NET_WM_STATE_STICKY",
+	"_NET_WM_STATE_MODAL"
 };
 
 #ifndef PREFIX
@@ -89,15 +103,28 @@ static char *atom_names[] = {
 static struct xinfo X;
 static struct panel P;
 
-static int timerfd;
+static int use_clock;
+static struct reactor_watch *clock_timer;
+static int sigfd = -1;
+
+/* Window -> struct task / struct tray lookups */
+static struct whash task_index;
+static struct whash tray_index;
+static struct task *focused_task;
 
 static int commence_taskbar_redraw;
+static int commence_tasks_redraw; /* only buttons marked as dirty */
 static int commence_panel_redraw;
 static int commence_switcher_redraw;
+static int commence_present;
+static uint frame_batch; /* X events handled since the last frame */
 
 static const char *theme = "native";
+static const char *record_file;
+static const char *replay_file;
 static const char *version = "bmpanel version " BMPANEL_VERSION;
-static const char *usage = "usage: bmpanel [--version] [--help] [--usage] [--list] THEME";
+static const char *usage = "usage: bmpanel [--version] [--help] [--usage] [--list] "
+			   "[--record FILE | --replay FILE] THEME";
 
 static void cleanup();
 
@@ -125,220 +152,114 @@ static int X_io_error_handler(Display *dpy)
   window properties
 **************************************************************************/
 
-static void *get_prop_data(Window win, Atom prop, Atom type, int *items)
-{
-	Atom type_ret;
-	int format_ret;
-	unsigned long items_ret;
-	unsigned long after_ret;
-	uchar *prop_data;
-
-	prop_data = 0;
-
-	XGetWindowProperty(X.display, win, prop, 0, 0x7fffffff, False,
-			type, &type_ret, &format_ret, &items_ret,
-			&after_ret, &prop_data);
-	if (items)
-		*items = items_ret;
-
-	return prop_data;
-}
+/* 
+ * All property reads go through xprop (see xprop.h), which means 32 bit 
+ * items are uint32_t here, not longs as with XGetWindowProperty.
+ */
 
-static int get_prop_int(Window win, Atom at)
+static int get_window_desktop(struct xprop *desktop)
 {
-	int num = 0;
-	long *data;
-
-	data = get_prop_data(win, at, XA_CARDINAL, 0);
-	if (data) {
-		num = *data;
-		XFree(data);
-	}
-	return num;
+	uint32_t *data = xprop_data(desktop, 0);
+	return data ? (int32_t)*data : 0;
 }
 
-static Window get_prop_window(Window win, Atom at)
+/* 
+ * Task icons come from the icon loader (see iconload.h), _NET_WM_ICON is
+ * fetched and scaled on its thread. Old style WM_HINTS pixmap icons need 
+ * Imlib, so they are grabbed here, when the loader finds no _NET_WM_ICON.
+ * Icons are shared by the icon cache, see iconcache.h.
+ */
+static Imlib_Image get_wm_hints_icon(Window win)
 {
-	Window num = 0;
-	Window *data;
-
-	data = get_prop_data(win, at, XA_WINDOW, 0);
-	if (data) {
-		num = *data;
-		XFree(data);
+	Imlib_Image ret = 0;
+	if (!X.display)
+		return 0;
+	XWMHints *hints = XGetWMHints(X.display, win);
+	if (hints) {
+		if (hints->flags & IconPixmapHint) {
+			Pixmap pix;
+			int x = 0, y = 0;
+			uint w = 0, h = 0, d = 0, bw = 0;
+			XGetGeometry(X.display, hints->icon_pixmap, &pix, 
+					&x, &y, &w, &h, &bw, &d);
+
+			imlib_context_set_drawable(hints->icon_pixmap);
+			Imlib_Image img = imlib_create_image_from_drawable(hints->icon_mask, 
+							x, y, w, h, 1);
+			if (img) {
+				imlib_context_set_image(img);
+				ret = iconcache_get(imlib_image_get_data_for_reading_only(), 
+						imlib_image_get_width(), 
+						imlib_image_get_height());
+				imlib_context_set_image(img);
+				imlib_free_image();
+			}
+		}
+		XFree(hints);
 	}
-	return num;
+	return ret;
 }
 
-static Pixmap get_prop_pixmap(Window win, Atom at)
-{
-	Pixmap num = 0;
-	Pixmap *data;
-
-	data = get_prop_data(win, at, XA_PIXMAP, 0);
-	if (data) {
-		num = *data;
-		XFree(data);
-	}
-	return num;
-}
+/* window name sources, in order of preference */
+#define NAME_PROPS 6
 
-static int get_window_desktop(Window win)
+static void request_window_name(Window win, struct xprop *names)
 {
-	return get_prop_int(win, X.atoms[XATOM_NET_WM_DESKTOP]);
+	xprop_request(&names[0], win, X.atoms[XATOM_NET_WM_VISIBLE_ICON_NAME], X.atoms[XATOM_UTF8_STRING]);
+	xprop_request(&names[1], win, X.atoms[XATOM_NET_WM_ICON_NAME], X.atoms[XATOM_UTF8_STRING]);
+	xprop_request(&names[2], win, XA_WM_ICON_NAME, XA_STRING);
+	xprop_request(&names[3], win, X.atoms[XATOM_NET_WM_VISIBLE_NAME], X.atoms[XATOM_UTF8_STRING]);
+	xprop_request(&names[4], win, X.atoms[XATOM_NET_WM_NAME], X.atoms[XATOM_UTF8_STRING]);
+	xprop_request(&names[5], win, XA_WM_NAME, XA_STRING);
 }
 
-static int is_window_hidden(Window win)
+static char *alloc_window_name(struct xprop *names)
 {
-	Atom *data;
-	int ret = 0;
-	int num;
-
-	data = get_prop_data(win, X.atoms[XATOM_NET_WM_WINDOW_TYPE], XA_ATOM, &num);
-	if (data) {
-		if (*data == X.atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK] ||
-		    *data == X.atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP]) 
-		{
-			XFree(data);
-			return 1;
-		}
-		XFree(data);
-	}
-
-	data = get_prop_data(win, X.atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (!data)
-		return 0;
+	char *name = 0;
+	int i;
 
-	while (num) {
-		num--;
-		if (data[num] == X.atoms[XATOM_NET_WM_STATE_SKIP_TASKBAR])
-			ret = 1;
+	for (i = 0; i < NAME_PROPS; ++i) {
+		if (!name)
+			name = xprop_strdup(&names[i]);
+		xprop_release(&names[i]);
 	}
-	XFree(data);
 
-	return ret;
+	return name ? name : xstrdup("<unknown>");
 }
 
-static int is_window_iconified(Window win)
-{
-	long *data;
-	int ret = 0;
-
-	data = get_prop_data(win, X.atoms[XATOM_WM_STATE], 
-	     		X.atoms[XATOM_WM_STATE], 0);
-	if (data) {
-		if (data[0] == IconicState) {
-			ret = 1;
-		}
-		XFree(data);
-	}
-
-	int num;
-	data = get_prop_data(win, X.atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (data) {
-		while (num) {
-			num--;
-			if (data[num] == X.atoms[XATOM_NET_WM_STATE_HIDDEN])
-				ret = 1;
-		}
-		XFree(data);
-	}
+/* 
+ * Everything add_task() wants to know about a window. Requested for one or
+ * many windows at once, replies are collected later.
+ */
+struct task_props {
+	Window win;
+	struct xprop type;
+	struct xprop state;
+	struct xprop wmstate;
+	struct xprop desktop;
+	struct xprop names[NAME_PROPS];
+};
 
-	return ret;
+static void request_task_props(struct task_props *tp, Window win)
+{
+	tp->win = win;
+	xprop_request(&tp->type, win, X.atoms[XATOM_NET_WM_WINDOW_TYPE], XA_ATOM);
+	xprop_request(&tp->state, win, X.atoms[XATOM_NET_WM_STATE], XA_ATOM);
+	xprop_request(&tp->wmstate, win, X.atoms[XATOM_WM_STATE], X.atoms[XATOM_WM_STATE]);
+	xprop_request(&tp->desktop, win, X.atoms[XATOM_NET_WM_DESKTOP], XA_CARDINAL);
+	request_window_name(win, tp->names);
 }
 
-static Imlib_Image get_window_icon(Window win)
+static void release_task_props(struct task_props *tp)
 {
-	if (!THEME_USE_TASKBAR_ICON(P.theme))
-		return 0;
-
-	Imlib_Image ret = 0;
-
-	int num = 0;
-	long *data = get_prop_data(win, X.atoms[XATOM_NET_WM_ICON], 
-					XA_CARDINAL, &num);
-	if (data) {
-		long *datal = data;
-		uint32_t w,h;
-		int i;
-		w = *datal++;
-		h = *datal++;
-		/* hack for 64 bit systems */
-		uint32_t *array = XMALLOC(uint32_t, w*h);
-		for (i = 0; i < w*h; ++i) 
-			array[i] = datal[i];
-		ret = imlib_create_image_using_copied_data(w,h,array);
-		xfree(array);
-		imlib_context_set_image(ret);
-		imlib_image_set_has_alpha(1);
-		XFree(data);
-	}
-
-	if (!ret) {
-	        XWMHints *hints = XGetWMHints(X.display, win);
-		if (hints) {
-			if (hints->flags & IconPixmapHint) {
-				Pixmap pix;
-				int x = 0, y = 0;
-				uint w = 0, h = 0, d = 0, bw = 0;
-				XGetGeometry(X.display, hints->icon_pixmap, &pix, 
-						&x, &y, &w, &h, &bw, &d);
-	
-				imlib_context_set_drawable(hints->icon_pixmap);
-				ret = imlib_create_image_from_drawable(hints->icon_mask, 
-								x, y, w, h, 1);
-			}
-	        	XFree(hints);
-		}
-	}
-
-	/* if we can't get icon, set default and return */
-	if (!ret) {
-		ret = P.theme->taskbar.default_icon_img;
-		return ret;
-	}
+	int i;
 
-	/* well, we have our icon, lets resize it for faster rendering */
-	int w,h;
-	imlib_context_set_image(ret);
-	w = imlib_image_get_width();
-	h = imlib_image_get_height();
-	Imlib_Image sizedicon = imlib_create_cropped_scaled_image(0, 0, w, h, 
-			P.theme->taskbar.icon_w, P.theme->taskbar.icon_h);
-	imlib_free_image();
-	imlib_context_set_image(sizedicon);
-	imlib_image_set_has_alpha(1);
-
-	return sizedicon;
-}
-
-static char *alloc_window_name(Window win)
-{
-	char *ret, *name = 0;
-	name = get_prop_data(win, X.atoms[XATOM_NET_WM_VISIBLE_ICON_NAME], X.atoms[XATOM_UTF8_STRING], 0);
-	if (name) 
-		goto name_here;
-	name = get_prop_data(win, X.atoms[XATOM_NET_WM_ICON_NAME], X.atoms[XATOM_UTF8_STRING], 0);
-	if (name) 
-		goto name_here;
-	name = get_prop_data(win, XA_WM_ICON_NAME, XA_STRING, 0);
-	if (name) 
-		goto name_here;
-	name = get_prop_data(win, X.atoms[XATOM_NET_WM_VISIBLE_NAME], X.atoms[XATOM_UTF8_STRING], 0);
-	if (name) 
-		goto name_here;
-	name = get_prop_data(win, X.atoms[XATOM_NET_WM_NAME], X.atoms[XATOM_UTF8_STRING], 0);
-	if (name) 
-		goto name_here;
-	name = get_prop_data(win, XA_WM_NAME, XA_STRING, 0);
-	if (name) 
-		goto name_here;
-
-	return xstrdup("<unknown>");
-name_here:
-	ret = xstrdup(name);
-	XFree(name);
-	return ret;
+	xprop_release(&tp->type);
+	xprop_release(&tp->state);
+	xprop_release(&tp->wmstate);
+	xprop_release(&tp->desktop);
+	for (i = 0; i < NAME_PROPS; ++i)
+		xprop_release(&tp->names[i]);
 }
 
 /**************************************************************************
@@ -527,13 +448,82 @@ static Window create_panel_window(uint placement, int alignment, int h, int w, i
 }
 
 
+/**************************************************************************
+  root window mirror
+**************************************************************************/
+
+/*
+ * Root window properties we read often. We get PropertyNotify for the root
+ * window anyway, so the copies are refreshed there (see 
+ * handle_property_notify) and reading them costs no round trips.
+ */
+enum {
+	ROOT_CURRENT_DESKTOP	= 1 << 0,
+	ROOT_NUMBER_OF_DESKTOPS	= 1 << 1,
+	ROOT_ACTIVE_WINDOW	= 1 << 2,
+	ROOT_ROOTPMAP		= 1 << 3,
+	ROOT_ALL		= (1 << 4) - 1
+};
+
+static struct {
+	int current_desktop;
+	int number_of_desktops;
+	Window active_window;
+} root;
+
+static void update_root_mirror(uint what)
+{
+	struct xprop pcurrent, pnum, pactive, prootpmap;
+	uint32_t *data;
+
+	memset(&pcurrent, 0, sizeof(pcurrent));
+	memset(&pnum, 0, sizeof(pnum));
+	memset(&pactive, 0, sizeof(pactive));
+	memset(&prootpmap, 0, sizeof(prootpmap));
+
+	if (what & ROOT_CURRENT_DESKTOP)
+		xprop_request(&pcurrent, X.root, X.atoms[XATOM_NET_CURRENT_DESKTOP], 
+				XA_CARDINAL);
+	if (what & ROOT_NUMBER_OF_DESKTOPS)
+		xprop_request(&pnum, X.root, X.atoms[XATOM_NET_NUMBER_OF_DESKTOPS], 
+				XA_CARDINAL);
+	if (what & ROOT_ACTIVE_WINDOW)
+		xprop_request(&pactive, X.root, X.atoms[XATOM_NET_ACTIVE_WINDOW], 
+				XA_WINDOW);
+	if (what & ROOT_ROOTPMAP)
+		xprop_request(&prootpmap, X.root, X.atoms[XATOM_XROOTPMAP_ID], 
+				XA_PIXMAP);
+
+	if (what & ROOT_CURRENT_DESKTOP) {
+		data = xprop_data(&pcurrent, 0);
+		root.current_desktop = data ? (int32_t)*data : 0;
+	}
+	if (what & ROOT_NUMBER_OF_DESKTOPS) {
+		data = xprop_data(&pnum, 0);
+		root.number_of_desktops = data ? (int32_t)*data : 0;
+	}
+	if (what & ROOT_ACTIVE_WINDOW) {
+		data = xprop_data(&pactive, 0);
+		root.active_window = data ? *data : None;
+	}
+	if (what & ROOT_ROOTPMAP) {
+		data = xprop_data(&prootpmap, 0);
+		X.rootpmap = data ? *data : None;
+	}
+
+	xprop_release(&pcurrent);
+	xprop_release(&pnum);
+	xprop_release(&pactive);
+	xprop_release(&prootpmap);
+}
+
 /**************************************************************************
   desktop management
 **************************************************************************/
 
 static int get_active_desktop()
 {
-	return get_prop_int(X.root, X.atoms[XATOM_NET_CURRENT_DESKTOP]);
+	return root.current_desktop;
 }
 
 static void set_active_desktop(int d)
@@ -549,43 +539,60 @@ static void set_active_desktop(int d)
 
 static int get_number_of_desktops()
 {
-	return get_prop_int(X.root, X.atoms[XATOM_NET_NUMBER_OF_DESKTOPS]);
+	return root.number_of_desktops;
 }
 
-static void free_desktops()
+static void free_desktop_list(struct desktop *iter)
 {
-	struct desktop *iter, *next;
-	iter = P.desktops;
+	struct desktop *next;
 	while (iter) {
 		next = iter->next;
 		xfree(iter->name);
 		xfree(iter);
 		iter = next;
 	}
+}
+
+static void free_desktops()
+{
+	free_desktop_list(P.desktops);
 	P.desktops = 0;
 }
 
 static void rebuild_desktops()
 {
+	TRACE_SCOPE("rebuild_desktops");
 	/* 
 	 * This function is not optimal. It frees all the desktops and create them again 
 	 * Anyway, if you change number of your desktops or desktop names in real time, you are
 	 * probably using wrong software, or maybe you were born in wrong world. 
+	 * The old list is kept until the new one is built, desktops with the
+	 * same name keep their measured text width.
 	 */
-	free_desktops();
+	struct desktop *old = P.desktops, *olditer = old;
+	P.desktops = 0;
 
 	struct desktop *last = P.desktops, *d = 0;
+	struct xprop pnames;
 	int desktopsnum = get_number_of_desktops();
 	int activedesktop = get_active_desktop();
-	int i, len;
+	int i;
 
-	char *name, *names;
-	names = name = get_prop_data(X.root, X.atoms[XATOM_NET_DESKTOP_NAMES], 
-			X.atoms[XATOM_UTF8_STRING], 0);
+	xprop_request(&pnames, X.root, X.atoms[XATOM_NET_DESKTOP_NAMES], 
+			X.atoms[XATOM_UTF8_STRING]);
+
+	/* names are null-separated, the last one isn't necessary terminated */
+	char *name, *names, *end = 0;
+	int len;
+	names = name = xprop_strdup(&pnames);
+	if (names) {
+		xprop_data(&pnames, &len);
+		end = names + len;
+	}
 
 	for (i = 0; i < desktopsnum; ++i) {
 		d = XMALLOCZ(struct desktop, 1);
-		if (names)
+		if (names && name < end)
 			d->name = xstrdup(name);
 		else {
 			char buf[16];
@@ -593,6 +600,12 @@ static void rebuild_desktops()
 			d->name = xstrdup(buf);
 		}
 		d->focused = (i == activedesktop);
+		d->textw = -1;
+		if (olditer) {
+			if (!strcmp(olditer->name, d->name))
+				d->textw = olditer->textw;
+			olditer = olditer->next;
+		}
 		if (!last) {
 			P.desktops = d;
 			last = d;
@@ -601,14 +614,14 @@ static void rebuild_desktops()
 			last = d;
 		}
 
-		if (names) {
-			len = strlen(name);
-			name += len + 1;
-		}
+		if (names && name < end)
+			name += strlen(name) + 1;
 	}
 
 	if (names)
-		XFree(names);
+		xfree(names);
+	free_desktop_list(old);
+	xprop_release(&pnames);
 }
 
 static void switch_desktop(int d)
@@ -655,169 +668,224 @@ static void activate_task(struct task *t)
 			SubstructureRedirectMask, (XEvent*)&e);
 }
 
+static void free_task_icon(struct task *t)
+{
+	if (t->icon && t->icon != P.theme->taskbar.default_icon_img)
+		iconcache_release(t->icon);
+	t->icon = 0;
+}
+
 static void free_tasks()
 {
-	struct task *iter, *next;
-	iter = P.tasks;
-	while (iter) {
-		next = iter->next;
-		if (iter->icon && iter->icon != P.theme->taskbar.default_icon_img) {
-			imlib_context_set_image(iter->icon);
-			imlib_free_image();
-		}
-		xfree(iter->name);
-		xfree(iter);
-		iter = next;
+	struct task *t;
+	uint i;
+	for (i = 0; i < task_index.size; ++i) {
+		t = task_index.entries[i].value;
+		if (!task_index.entries[i].key)
+			continue;
+		free_task_icon(t);
+		xfree(t->name);
+		xfree(t);
 	}
+	tasklist_free(&P.tasks);
+	focused_task = 0;
+	whash_free(&task_index);
 }
 
-static void add_task(Window win, uint focused)
+static void focus_task(struct task *t)
 {
-	if (is_window_hidden(win))
-		return;
-
-	struct task *t = XMALLOCZ(struct task, 1);
-	t->win = win;
-	t->name = alloc_window_name(win); 
-	t->desktop = get_window_desktop(win);
-	t->iconified = is_window_iconified(win); 
-	t->focused = focused;
-	t->icon = get_window_icon(win);
-
-	XSelectInput(X.display, win, PropertyChangeMask | 
-			FocusChangeMask | StructureNotifyMask);
-
-	/* put task in list */
-	struct task *iter = P.tasks;
-	if (!iter || iter->desktop > t->desktop) {
-		t->next = P.tasks;
-		P.tasks = t;
+	if (focused_task == t)
 		return;
+	if (focused_task) {
+		focused_task->focused = 0;
+		focused_task->dirty = 1;
 	}
-
-	for (;;) {
-		if (!iter->next || iter->next->desktop > t->desktop) {
-			t->next = iter->next;
-			iter->next = t;
-			return;
-		}
-		iter = iter->next;
+	focused_task = t;
+	if (t) {
+		t->focused = 1;
+		t->dirty = 1;
 	}
 }
 
-static void sort_move_task(struct task *rt)
+static struct task *find_task(Window win)
 {
-	struct task *prev = 0, *next, *iter, *t = P.tasks;
-	while (t) {
-		next = t->next;
-		if (t->win == rt->win) {
-			if (!prev)
-				P.tasks = next;
-			else 
-				prev->next = next;
-			break;
+	return whash_get(&task_index, win);
+}
+
+/* turns finished icon loads into task icons */
+static void apply_loaded_icons()
+{
+	TRACE_SCOPE("apply_loaded_icons");
+	struct icon_result *r, *next;
+	struct task *t;
+
+	for (r = iconload_collect(); r; r = next) {
+		next = r->next;
+		t = find_task(r->win);
+		if (t) {
+			Imlib_Image icon = 0;
+			if (r->pixels)
+				icon = iconcache_get_hashed(r->hash, r->srcw, r->srch, 
+						r->pixels, r->w, r->h);
+			if (!icon)
+				icon = get_wm_hints_icon(t->win);
+			if (!icon)
+				icon = P.theme->taskbar.default_icon_img;
+			free_task_icon(t);
+			t->icon = icon;
+			t->dirty = 1;
+			commence_tasks_redraw = 1;
 		}
-		prev = t;
-		t = next;
+		iconload_free_result(r);
 	}
+}
 
-	iter = P.tasks;
-	if (!iter || iter->desktop > t->desktop) {
-		t->next = P.tasks;
-		P.tasks = t;
+static void request_task_icon(struct task *t)
+{
+	if (!THEME_USE_TASKBAR_ICON(P.theme))
 		return;
-	}
+	/* no worker thread, it's loaded already */
+	if (!iconload_request(t->win))
+		apply_loaded_icons();
+}
 
-	for (;;) {
-		if (!iter->next || iter->next->desktop > t->desktop) {
-			t->next = iter->next;
-			iter->next = t;
-			return;
-		}
-		iter = iter->next;
-	}
+static void add_task(struct task_props *tp, uint focused)
+{
+	Window win = tp->win;
+	uint state = winstate_decode_type(&tp->type) | 
+		winstate_decode_net(&tp->state) |
+		winstate_decode_wm(&tp->wmstate);
+	if (WINSTATE_IS_HIDDEN(state))
+		return;
+
+	struct task *t = XMALLOCZ(struct task, 1);
+	t->win = win;
+	t->name = alloc_window_name(tp->names); 
+	t->desktop = get_window_desktop(&tp->desktop);
+	t->state = state;
+	t->iconified = WINSTATE_IS_ICONIFIED(state) != 0;
+	/* real icon comes later, see request_task_icon() */
+	if (THEME_USE_TASKBAR_ICON(P.theme))
+		t->icon = P.theme->taskbar.default_icon_img;
+	if (focused)
+		focus_task(t);
+	whash_put(&task_index, win, t);
+
+	if (X.display)
+		XSelectInput(X.display, win, PropertyChangeMask | 
+				FocusChangeMask | StructureNotifyMask);
+
+	tasklist_add(&P.tasks, t);
+	request_task_icon(t);
 }
 
 static void del_task(Window win)
 {
-	struct task *prev = 0, *next, *iter = P.tasks;
-	while (iter) {
-		next = iter->next;
-		if (iter->win == win) {
-			if (iter->icon && iter->icon != P.theme->taskbar.default_icon_img) {
-				imlib_context_set_image(iter->icon);
-				imlib_free_image();
-			}
-			xfree(iter->name);
-			xfree(iter);
-			if (!prev)
-				P.tasks = next;
-			else
-				prev->next = next;
-			return;
-		}
-		prev = iter;
-		iter = next;
-	}
+	struct task *t = whash_get(&task_index, win);
+	if (!t)
+		return;
+
+	whash_del(&task_index, win);
+	if (t == focused_task)
+		focused_task = 0;
+
+	tasklist_remove(&P.tasks, t);
+
+	free_task_icon(t);
+	xfree(t->name);
+	xfree(t);
 }
 
-static struct task *find_task(Window win)
+static void update_tasks_focus(Window win)
 {
-	struct task *iter = P.tasks;
-	while (iter) {
-		if (iter->win == win)
-			return iter;
-		iter = iter->next;
-	}
-	return 0;
+	focus_task(find_task(win));
 }
 
-static void update_tasks_focus(Window win)
+static int compare_windows(const void *a, const void *b)
 {
-	struct task *iter = P.tasks;
-	while (iter) {
-		iter->focused = (iter->win == win);
-		iter = iter->next;
-	}
+	Window wa = *(const Window*)a;
+	Window wb = *(const Window*)b;
+	return (wa > wb) - (wa < wb);
 }
 
 static void update_tasks()
 {
-	Window *wins, focuswin;
-	int num, i, j, rev;
+	TRACE_SCOPE("update_tasks");
+	Window *sorted, *known, *fresh, focuswin;
+	uint32_t *wins;
+	int num, knownnum, freshnum, i, j, rev;
+	struct xprop pclients;
 
-	XGetInputFocus(X.display, &focuswin, &rev);
+	/* a replay knows only what the window manager said */
+	if (X.display)
+		XGetInputFocus(X.display, &focuswin, &rev);
+	else
+		focuswin = root.active_window;
 
-	wins = get_prop_data(X.root, X.atoms[XATOM_NET_CLIENT_LIST], XA_WINDOW, &num);
+	xprop_request(&pclients, X.root, X.atoms[XATOM_NET_CLIENT_LIST], XA_WINDOW);
+	wins = xprop_data(&pclients, &num);
 
 	/* if there are no client list? we are in not NETWM compliant wm? */
 	/* if (!wins) return; */
 
-	/* if one or more windows in my list are not in _NET_CLIENT_LIST, delete them */
-	struct task *next, *iter = P.tasks;
-	while (iter) {
-		iter->focused = (focuswin == iter->win);
-		next = iter->next;
-		for (j = 0; j < num; ++j) {
-			if (iter->win == wins[j])
-				goto nodelete;
+	/* 
+	 * Sort both the client list and our tasks, then walk them together: 
+	 * every task which has no pair in the client list is gone.
+	 */
+	sorted = XMALLOC(Window, num + 1);
+	for (i = 0; i < num; ++i)
+		sorted[i] = wins[i];
+	qsort(sorted, num, sizeof(Window), compare_windows);
+
+	knownnum = 0;
+	known = XMALLOC(Window, task_index.count + 1);
+	for (i = 0; i < task_index.size; ++i) {
+		if (task_index.entries[i].key)
+			known[knownnum++] = task_index.entries[i].key;
+	}
+	qsort(known, knownnum, sizeof(Window), compare_windows);
+
+	i = j = 0;
+	while (i < knownnum) {
+		if (j == num || known[i] < sorted[j]) {
+			del_task(known[i++]);
+		} else if (known[i] > sorted[j]) {
+			j++;
+		} else {
+			i++;
+			j++;
 		}
-		del_task(iter->win);
-nodelete:
-		iter = next;
 	}
+	xfree(known);
+	xfree(sorted);
+
+	focus_task(find_task(focuswin));
 
-	/* for each window in _NET_CLIENT_LIST, check if it is in out list, if
-	   it's not, add it */
+	/* new windows are added in client list order, it's their mapping order */
+	freshnum = 0;
+	fresh = XMALLOC(Window, num + 1);
 	for (i = 0; i < num; ++i) {
 		/* skip panel */
 		if (wins[i] == P.win)
 			continue;
 
 		if (!find_task(wins[i]))
-			add_task(wins[i], (wins[i] == focuswin));
+			fresh[freshnum++] = wins[i];
+	}
+	xprop_release(&pclients);
+
+	/* ask for properties of all new windows at once, then collect replies */
+	if (freshnum) {
+		struct task_props *tps = XMALLOC(struct task_props, freshnum);
+		for (i = 0; i < freshnum; ++i)
+			request_task_props(&tps[i], fresh[i]);
+		for (i = 0; i < freshnum; ++i) {
+			add_task(&tps[i], (fresh[i] == focuswin));
+			release_task_props(&tps[i]);
+		}
+		xfree(tps);
 	}
-	XFree(wins);
+	xfree(fresh);
 }
 
 /**************************************************************************
@@ -887,6 +955,7 @@ static void add_tray_icon(Window win)
 	struct tray *t = XMALLOCZ(struct tray, 1);
 
 	t->win = win;
+	whash_put(&tray_index, win, t);
 	
 	/* listen necessary events */
 	XSelectInput(X.display, t->win, ExposureMask | StructureNotifyMask);
@@ -911,18 +980,17 @@ static void add_tray_icon(Window win)
 
 static struct tray *find_tray_icon(Window win)
 {
-	struct tray *iter = P.trayicons;
-	while (iter) {
-		if (iter->win == win)
-			return iter;
-		iter = iter->next;
-	}
-	return 0;
+	return whash_get(&tray_index, win);
 }
 
 static void del_tray_icon(Window win)
 {
-	struct tray *prev = 0, *next, *t = P.trayicons;
+	struct tray *prev = 0, *next, *t;
+	if (!find_tray_icon(win))
+		return;
+	whash_del(&tray_index, win);
+
+	t = P.trayicons;
 	while (t) {
 		next = t->next;
 		if (t->win == win)
@@ -950,7 +1018,181 @@ static void free_tray_icons()
 		xfree(iter);
 		iter = next;
 	}
-	XSync(X.display, 0);
+	P.trayicons = 0;
+	whash_free(&tray_index);
+	if (X.display)
+		XSync(X.display, 0);
+}
+
+/**************************************************************************
+  stale properties
+**************************************************************************/
+
+/*
+ * Per-window property notifies only mark the property stale. Everything
+ * stale is fetched in one batch right before the next frame, so a window
+ * retitling itself ten times between two frames costs one fetch.
+ */
+
+enum {
+	STALE_NAME		= 1 << 0,
+	STALE_DESKTOP		= 1 << 1,
+	STALE_NET_STATE		= 1 << 2,
+	STALE_WM_STATE		= 1 << 3,
+	STALE_TYPE		= 1 << 4
+};
+
+struct stale_props {
+	struct task *t;
+	uint what;
+	struct xprop names[NAME_PROPS];
+	struct xprop desktop;
+	struct xprop netstate;
+	struct xprop wmstate;
+	struct xprop type;
+};
+
+static Window *stale_wins;
+static uint stale_count;
+static uint stale_alloc;
+
+static void mark_stale(struct task *t, uint what)
+{
+	if (!t->stale) {
+		if (stale_count == stale_alloc) {
+			uint alloc = stale_alloc ? stale_alloc * 2 : 32;
+			Window *wins = XMALLOC(Window, alloc);
+			if (stale_count)
+				memcpy(wins, stale_wins, sizeof(Window) * stale_count);
+			if (stale_wins)
+				xfree(stale_wins);
+			stale_wins = wins;
+			stale_alloc = alloc;
+		}
+		stale_wins[stale_count++] = t->win;
+	}
+	t->stale |= what;
+}
+
+static void free_stale()
+{
+	if (stale_wins)
+		xfree(stale_wins);
+	stale_wins = 0;
+	stale_count = stale_alloc = 0;
+}
+
+static void request_stale_props(struct stale_props *sp)
+{
+	Window win = sp->t->win;
+	if (sp->what & STALE_NAME)
+		request_window_name(win, sp->names);
+	if (sp->what & STALE_DESKTOP)
+		xprop_request(&sp->desktop, win, X.atoms[XATOM_NET_WM_DESKTOP], XA_CARDINAL);
+	if (sp->what & STALE_NET_STATE)
+		xprop_request(&sp->netstate, win, X.atoms[XATOM_NET_WM_STATE], XA_ATOM);
+	if (sp->what & STALE_WM_STATE)
+		xprop_request(&sp->wmstate, win, X.atoms[XATOM_WM_STATE], 
+				X.atoms[XATOM_WM_STATE]);
+	if (sp->what & STALE_TYPE)
+		xprop_request(&sp->type, win, X.atoms[XATOM_NET_WM_WINDOW_TYPE], XA_ATOM);
+}
+
+/* returns LAYOUT_* bits of what needs to be laid out again */
+static uint apply_stale_props(struct stale_props *sp)
+{
+	struct task *t = sp->t;
+	uint state = t->state;
+	uint relayout = 0;
+
+	/* window changed it's visible name or name */
+	if (sp->what & STALE_NAME) {
+		xfree(t->name);
+		t->name = alloc_window_name(sp->names);
+		t->dirty = 1;
+		commence_tasks_redraw = 1;
+	}
+
+	/* widow changed it's desktop */
+	if (sp->what & STALE_DESKTOP) {
+		tasklist_move(&P.tasks, t, get_window_desktop(&sp->desktop));
+		relayout |= LAYOUT_TASKBAR;
+		commence_switcher_redraw = 1;
+		commence_taskbar_redraw = 1;
+	}
+
+	/* window state changed, each property replaces its own bits */
+	if (sp->what & STALE_NET_STATE)
+		state = (state & ~WINSTATE_NET_MASK) | winstate_decode_net(&sp->netstate);
+	if (sp->what & STALE_WM_STATE)
+		state = (state & ~WINSTATE_WM_MASK) | winstate_decode_wm(&sp->wmstate);
+	if (sp->what & STALE_TYPE)
+		state = (state & ~WINSTATE_TYPE_MASK) | winstate_decode_type(&sp->type);
+	t->state = state;
+
+	if (WINSTATE_IS_HIDDEN(state)) {
+		del_task(t->win);
+		commence_taskbar_redraw = 1;
+		return relayout | LAYOUT_TASKBAR;
+	}
+
+	uint iconified = WINSTATE_IS_ICONIFIED(state) != 0;
+	if (t->iconified != iconified) {
+		t->iconified = iconified;
+		t->dirty = 1;
+		/* iconified window can't be active, WM will tell us who is */
+		if (iconified && t->focused)
+			focus_task(0);
+		commence_tasks_redraw = 1;
+	}
+	return relayout;
+}
+
+static void release_stale_props(struct stale_props *sp)
+{
+	int i;
+
+	for (i = 0; i < NAME_PROPS; ++i)
+		xprop_release(&sp->names[i]);
+	xprop_release(&sp->desktop);
+	xprop_release(&sp->netstate);
+	xprop_release(&sp->wmstate);
+	xprop_release(&sp->type);
+}
+
+static void fetch_stale_props()
+{
+	TRACE_SCOPE("fetch_stale_props");
+	struct stale_props *sp;
+	struct task *t;
+	uint i, num = 0, relayout = 0;
+
+	if (!stale_count)
+		return;
+
+	/* requests first, all of them cost one round trip */
+	sp = XMALLOCZ(struct stale_props, stale_count);
+	for (i = 0; i < stale_count; ++i) {
+		t = find_task(stale_wins[i]);
+		/* deleted or already taken (XID reused by a new task) */
+		if (!t || !t->stale)
+			continue;
+		sp[num].t = t;
+		sp[num].what = t->stale;
+		t->stale = 0;
+		request_stale_props(&sp[num]);
+		num++;
+	}
+	stale_count = 0;
+
+	for (i = 0; i < num; ++i) {
+		relayout |= apply_stale_props(&sp[i]);
+		release_stale_props(&sp[i]);
+	}
+	xfree(sp);
+
+	if (relayout)
+		render_update_panel_positions(&P, relayout);
 }
 
 /**************************************************************************
@@ -959,17 +1201,19 @@ static void free_tray_icons()
 
 static void handle_client_message(XClientMessageEvent *e)
 {
+	TRACE_SCOPE("handle_client_message");
 	if (e->message_type == X.atoms[XATOM_NET_SYSTEM_TRAY_OPCODE] &&
 	    e->data.l[1] == TRAY_REQUEST_DOCK) 
 	{
 		add_tray_icon(e->data.l[2]);		
-		render_update_panel_positions(&P);
+		render_update_panel_positions(&P, LAYOUT_TRAY);
 		commence_panel_redraw = 1;
 	}
 }
 
 static void handle_selection_clear(XSelectionClearEvent *e)
 {
+	TRACE_SCOPE("handle_selection_clear");
 	if (!is_element_in_theme(P.theme, 't'))
 		return;
 
@@ -980,18 +1224,20 @@ static void handle_selection_clear(XSelectionClearEvent *e)
 
 static void handle_reparent_notify(Window win, Window parent)
 {
+	TRACE_SCOPE("handle_reparent_notify");
 	struct tray *t = find_tray_icon(win);
 	if (!t)
 		return;
 	if (P.win != parent) {
 		del_tray_icon(win);
-		render_update_panel_positions(&P);
+		render_update_panel_positions(&P, LAYOUT_TRAY);
 		commence_panel_redraw = 1;
 	}
 }
 
 static void handle_configure_notify(Window win)
 {
+	TRACE_SCOPE("handle_configure_notify");
 	struct tray *t = find_tray_icon(win);
 	if (t) {
 		XWindowChanges wc;
@@ -1005,22 +1251,26 @@ static void handle_configure_notify(Window win)
 
 static void handle_property_notify(Window win, Atom a)
 {
+	TRACE_SCOPE("handle_property_notify");
 	/* global changes */
 	if (win == X.root) {
 		/* user or WM reconfigured it's desktops */
 		if (a == X.atoms[XATOM_NET_NUMBER_OF_DESKTOPS] ||
 		    a == X.atoms[XATOM_NET_DESKTOP_NAMES])
 		{
+			if (a == X.atoms[XATOM_NET_NUMBER_OF_DESKTOPS])
+				update_root_mirror(ROOT_NUMBER_OF_DESKTOPS);
 			rebuild_desktops();
-			render_update_panel_positions(&P);
+			render_update_panel_positions(&P, LAYOUT_SWITCHER | LAYOUT_TASKBAR);
 			commence_panel_redraw = 1;
 			return;
 		}
 
 		/* user or WM switched desktop */
 		if (a == X.atoms[XATOM_NET_CURRENT_DESKTOP]) {
+			update_root_mirror(ROOT_CURRENT_DESKTOP);
 			set_active_desktop(get_active_desktop());
-			render_update_panel_positions(&P);
+			render_update_panel_positions(&P, LAYOUT_SWITCHER | LAYOUT_TASKBAR);
 			commence_switcher_redraw = 1;
 			commence_taskbar_redraw = 1;
 			return;
@@ -1029,21 +1279,20 @@ static void handle_property_notify(Window win, Atom a)
 		/* updates in client list */
 		if (a == X.atoms[XATOM_NET_CLIENT_LIST]) {
 			update_tasks();
-			render_update_panel_positions(&P);
+			render_update_panel_positions(&P, LAYOUT_TASKBAR);
 			commence_taskbar_redraw = 1;
 			return;
 		}
 
 		if (a == X.atoms[XATOM_NET_ACTIVE_WINDOW]) {
-			Window win = get_prop_window(X.root, X.atoms[XATOM_NET_ACTIVE_WINDOW]);
-			update_tasks_focus(win);
-			commence_taskbar_redraw = 1;
+			update_root_mirror(ROOT_ACTIVE_WINDOW);
+			update_tasks_focus(root.active_window);
+			commence_tasks_redraw = 1;
 			return;
 		}
 
 		if (a == X.atoms[XATOM_XROOTPMAP_ID]) {
-			X.rootpmap = get_prop_pixmap(X.root, X.atoms[XATOM_XROOTPMAP_ID]);
-			render_update_panel_positions(&P);
+			update_root_mirror(ROOT_ROOTPMAP);
 			return;
 		}
 	}
@@ -1051,73 +1300,51 @@ static void handle_property_notify(Window win, Atom a)
 	/* now it's time for per-window changes */
 	struct task *t = find_task(win);
 	if (!t) {
-		render_present();
-		return;
-	}
-
-	/* widow changed it's desktop */
-	if (a == X.atoms[XATOM_NET_WM_DESKTOP]) {
-		t->desktop = get_window_desktop(win);
-		sort_move_task(t);
-		render_update_panel_positions(&P);
-		commence_switcher_redraw = 1;
-		commence_taskbar_redraw = 1;
-		return;
-	}
-	
-	/* window changed it's visible name or name */
-	if (a == X.atoms[XATOM_NET_WM_NAME] || 
-	    a == X.atoms[XATOM_NET_WM_VISIBLE_NAME]) 
-	{
-		xfree(t->name);
-		t->name = alloc_window_name(t->win);
-		commence_taskbar_redraw = 1;
+		commence_present = 1;
 		return;
 	}
 
-	if (a == X.atoms[XATOM_NET_WM_STATE] ||
-	    a == X.atoms[XATOM_WM_STATE]) 
-	{
-		if (is_window_hidden(t->win)) {
-			del_task(t->win);
-			return;
-		}
-		t->iconified = is_window_iconified(t->win);
-		t->focused = (get_prop_window(X.root, X.atoms[XATOM_NET_ACTIVE_WINDOW]) == t->win);
-		
-		commence_taskbar_redraw = 1;
-		return;
-	}
-
-	if (a == X.atoms[XATOM_NET_WM_ICON] ||
-	    a == XA_WM_HINTS) 
-	{
-		if (t->icon && t->icon != P.theme->taskbar.default_icon_img) {
-			imlib_context_set_image(t->icon);
-			imlib_free_image();
-		}
-		t->icon = get_window_icon(t->win);
-		commence_taskbar_redraw = 1;
-		return;
-	}
+	/* the rest is fetched right before the next frame, see fetch_stale_props() */
+	if (a == X.atoms[XATOM_NET_WM_DESKTOP])
+		mark_stale(t, STALE_DESKTOP);
+	else if (a == X.atoms[XATOM_NET_WM_NAME] || 
+		 a == X.atoms[XATOM_NET_WM_VISIBLE_NAME]) 
+		mark_stale(t, STALE_NAME);
+	else if (a == X.atoms[XATOM_NET_WM_STATE])
+		mark_stale(t, STALE_NET_STATE);
+	else if (a == X.atoms[XATOM_WM_STATE])
+		mark_stale(t, STALE_WM_STATE);
+	else if (a == X.atoms[XATOM_NET_WM_WINDOW_TYPE])
+		mark_stale(t, STALE_TYPE);
+	/* old icon stays until the new one is loaded */
+	else if (a == X.atoms[XATOM_NET_WM_ICON] || a == XA_WM_HINTS) 
+		request_task_icon(t);
 }
 
 static void handle_button(int x, int y, int button)
 {
+	TRACE_SCOPE("handle_button");
 	int adesk = get_active_desktop();
+	struct task_bucket *buckets[2] = {
+		&P.tasks.sticky,
+		tasklist_bucket(&P.tasks, adesk)
+	};
+	struct task *iter;
+	uint i, j;
 
 	/* second button iconize all windows, we want to see our desktop */
 	if (button == 3) {
-		struct task *iter = P.tasks;
-		while (iter) {
-			if (iter->desktop == adesk || iter->desktop == -1) {
+		for (i = 0; i < 2; ++i) {
+			for (j = 0; j < buckets[i]->count; ++j) {
+				iter = buckets[i]->tasks[j];
 				iter->iconified = 1;
-				iter->focused = 0;
+				iter->dirty = 1;
+				if (iter->focused)
+					focus_task(0);
 				XIconifyWindow(X.display, iter->win, X.screen);
 			}
-			iter = iter->next;
 		}
-		commence_taskbar_redraw = 1;
+		commence_tasks_redraw = 1;
 		return;
 	}
 
@@ -1136,23 +1363,22 @@ static void handle_button(int x, int y, int button)
 	}
 
 	/* check taskbar */
-	struct task *iter = P.tasks;
-	while (iter) {
-		if ((iter->desktop == adesk || iter->desktop == -1) &&
-		    x > iter->posx && 
-		    x < iter->posx + iter->width) 
-		{
+	for (i = 0; i < 2; ++i) {
+		for (j = 0; j < buckets[i]->count; ++j) {
+			iter = buckets[i]->tasks[j];
+			if (x <= iter->posx || x >= iter->posx + iter->width)
+				continue;
 			if (iter->iconified) {
 				iter->iconified = 0;
-				iter->focused = 1;
+				focus_task(iter);
 				activate_task(iter);
 			} else {
 				if (iter->focused) {
 					iter->iconified = 1;
-					iter->focused = 0;
+					focus_task(0);
 					XIconifyWindow(X.display, iter->win, X.screen);
 				} else {
-					iter->focused = 1;
+					focus_task(iter);
 					activate_task(iter);
 					
 					XWindowChanges wc;
@@ -1161,34 +1387,33 @@ static void handle_button(int x, int y, int button)
 				}
 			}
 			/* commence_taskbar_redraw = 1; */
-		} else if (iter->desktop == adesk) {
-			iter->focused = 0;
+			return;
 		}
-		iter = iter->next;
 	}
 }
 
 static void handle_focusin(Window win)
 {
-	struct task *iter = P.tasks;
-	while (iter) {
-		iter->focused = (iter->win == win);
-		iter = iter->next;
-	}
+	TRACE_SCOPE("handle_focusin");
+	focus_task(find_task(win));
 }
 
 /**************************************************************************
   initialization
 **************************************************************************/
 
-static void initX()
+static void connectX()
 {
+	/* icon loader thread uses the connection through XCB, see iconload.h */
+	XInitThreads();
+
 	/* open connection to X server */
 	X.display = XOpenDisplay(0);
 	if (!X.display)
 		LOG_ERROR("failed connect to X server");
 	XSetErrorHandler(X_error_handler);
 	XSetIOErrorHandler(X_io_error_handler);
+	xprop_init(X.display);
 	
 	memset(&X.attrs, 0, sizeof(X.attrs));
 
@@ -1210,17 +1435,35 @@ static void initX()
 	XInternAtoms(X.display, atom_names, XATOM_COUNT, False, X.atoms);
 	XSelectInput(X.display, X.root, PropertyChangeMask);
 
-	X.rootpmap = get_prop_pixmap(X.root, X.atoms[XATOM_XROOTPMAP_ID]);
+	if (record_file && replay_record_start(record_file, &X) == -1)
+		LOG_ERROR("failed to create recording: %s", record_file);
+}
+
+static void initX()
+{
+	if (replay_file) {
+		/* no server, screen, root and atoms come from the recording */
+		if (replay_open(replay_file, &X) == -1)
+			LOG_ERROR("failed to open recording: %s", replay_file);
+	} else {
+		connectX();
+	}
+
+	winstate_init(X.atoms);
+	update_root_mirror(ROOT_ALL);
 
 	/* get workarea */
-	long *workarea = get_prop_data(X.root, X.atoms[XATOM_NET_WORKAREA], XA_CARDINAL, 0);
-	if (workarea) {
+	struct xprop pworkarea;
+	int num;
+	xprop_request(&pworkarea, X.root, X.atoms[XATOM_NET_WORKAREA], XA_CARDINAL);
+	uint32_t *workarea = xprop_data(&pworkarea, &num);
+	if (workarea && num >= 4) {
 		X.wa_x = workarea[0];
 		X.wa_y = workarea[1];
 		X.wa_w = workarea[2];
 		X.wa_h = workarea[3];
-		XFree(workarea);	
 	}
+	xprop_release(&pworkarea);
 }
 
 static void initP(const char *theme)
@@ -1251,6 +1494,12 @@ validation:
 	if (!theme_is_valid(P.theme))
 		LOG_ERROR("invalid theme: %s", theme);
 
+	/* replay has no server to composite with or to dock icons to */
+	if (!X.display) {
+		P.theme->use_composite = 0;
+		theme_remove_element(P.theme, 't');
+	}
+
 	/* setup composite if necessary */
 #ifdef WITH_COMPOSITE
 	if (P.theme->use_composite)
@@ -1263,11 +1512,16 @@ validation:
 		P.width = (P.theme->width_type == WIDTH_TYPE_PERCENT) ? 
 			(int)((X.wa_w * P.theme->width) / 100) : 
 			P.theme->width;
-	P.win = create_panel_window(P.theme->placement, 
-			            P.theme->alignment, 
-				    P.theme->height,
-				    P.width,
-				    P.theme->height_override);
+
+	/* prepare tile strips, now we know how wide they should be */
+	theme_expand_tiles(P.theme, P.width);
+
+	if (X.display)
+		P.win = create_panel_window(P.theme->placement, 
+					    P.theme->alignment, 
+					    P.theme->height,
+					    P.width,
+					    P.theme->height_override);
 
 #ifdef WITH_COMPOSITE
 	if (P.theme->use_composite)
@@ -1279,6 +1533,16 @@ validation:
 	}
 #endif
 
+	whash_init(&task_index);
+	tasklist_init(&P.tasks);
+	iconcache_init(P.theme->taskbar.icon_w, P.theme->taskbar.icon_h, 
+			render_forget_image);
+	whash_init(&tray_index);
+
+	use_clock = is_element_in_theme(P.theme, 'c');
+	if (use_clock)
+		clocksched_init(P.theme->clock.format);
+
 	/* init tray if needed */
 	if (is_element_in_theme(P.theme, 't'))
 		init_tray();
@@ -1293,18 +1557,29 @@ static void freeP()
 	if (is_element_in_theme(P.theme, 't'))
 		shutdown_tray();
 	free_tray_icons();
-	free_theme(P.theme);
 	free_tasks();
+	free_stale();
+	iconcache_shutdown();
+	free_theme(P.theme);
 	free_desktops();
-	XDestroyWindow(X.display, P.win);
-	XCloseDisplay(X.display);
+	if (X.display) {
+		XDestroyWindow(X.display, P.win);
+		XCloseDisplay(X.display);
+	}
 }
 
 static void cleanup()
 {
+	perf_dump();
+	trace_write();
+	reactor_shutdown();
+	iconload_shutdown();
 	shutdown_render();
 	freeP();
-	/* close(timerfd); */
+	replay_record_stop();
+	replay_close();
+	if (sigfd != -1)
+		close(sigfd);
 	LOG_MESSAGE("cleanup");
 }
 
@@ -1312,89 +1587,219 @@ static void cleanup()
   event callbacks
 **************************************************************************/
 
-static void xconnection_cb()
+static void frame_cb(void *arg);
+
+static void handle_event(XEvent *e)
+{
+	switch (e->type) {
+	case SelectionClear:
+		handle_selection_clear(&e->xselectionclear);
+		break;
+	case Expose:
+		commence_panel_redraw = 1;
+		break;
+	case ButtonPress:
+		handle_button(e->xbutton.x, e->xbutton.y, e->xbutton.button);
+		break;
+	case ConfigureNotify:
+		handle_configure_notify(e->xconfigure.window);
+		break;
+	case PropertyNotify:
+		handle_property_notify(e->xproperty.window, e->xproperty.atom);	
+		break;
+	case FocusIn:
+		handle_focusin(e->xfocus.window);
+		commence_tasks_redraw = 1;
+		break;
+	case ClientMessage:
+		handle_client_message(&e->xclient);
+		break;
+	case ReparentNotify:
+		handle_reparent_notify(e->xreparent.window, e->xreparent.parent);
+		break;
+	case DestroyNotify:
+		del_tray_icon(e->xdestroywindow.window);
+		render_update_panel_positions(&P, LAYOUT_TRAY);
+		commence_panel_redraw = 1;
+		break;
+	default:
+		shm_handle_event(e);
+		break;
+	}
+}
+
+static void xconnection_cb(int fd, uint events, void *arg)
 {
+	TRACE_SCOPE("xconnection_cb");
 	XEvent e;
+	uint batch = 0;
+
+	/*
+	 * Drain everything Xlib has queued before drawing anything. Handlers only
+	 * raise commence_* flags and the frame is drawn once the loop is done 
+	 * with this wakeup, so a burst of events (e.g. a lot of windows changing 
+	 * their titles at once) costs us one render and one present.
+	 */
 	while (XPending(X.display)) {
 		XNextEvent(X.display, &e);
-		switch (e.type) {
-		case SelectionClear:
-			handle_selection_clear(&e.xselectionclear);
-			break;
-		case Expose:
-			commence_panel_redraw = 1;
-			break;
-		case ButtonPress:
-			handle_button(e.xbutton.x, e.xbutton.y, e.xbutton.button);
-			break;
-		case ConfigureNotify:
-			handle_configure_notify(e.xconfigure.window);
-			break;
-		case PropertyNotify:
-			handle_property_notify(e.xproperty.window, e.xproperty.atom);	
-			break;
-		case FocusIn:
-			handle_focusin(e.xfocus.window);
-			render_update_panel_positions(&P);
-			commence_taskbar_redraw = 1;
-			break;
-		case ClientMessage:
-			handle_client_message(&e.xclient);
-			break;
-		case ReparentNotify:
-			handle_reparent_notify(e.xreparent.window, e.xreparent.parent);
-			break;
-		case DestroyNotify:
-			del_tray_icon(e.xdestroywindow.window);
-			render_update_panel_positions(&P);
-			commence_panel_redraw = 1;
-			break;
-		default:
-			break;
+		batch++;
+		PERF_COUNT_EVENT(e.type);
+		perf_input_arrived();
+		if (replay_recording())
+			replay_record_event(&e);
+		handle_event(&e);
+	}
+
+	if (!batch)
+		return;
+	frame_batch += batch;
+	reactor_defer(frame_cb, 0);
+}
+
+static void xqueue_cb(void *arg)
+{
+	xconnection_cb(ConnectionNumber(X.display), REACTOR_READ, 0);
+}
+
+static void frame_cb(void *arg)
+{
+	TRACE_SCOPE("frame_cb");
+	if (frame_batch && replay_recording())
+		replay_record_frame();
+	fetch_stale_props();
+	
+	if (commence_panel_redraw) {
+		render_panel(&P);
+	} else if (commence_switcher_redraw || commence_taskbar_redraw) {
+		if (commence_switcher_redraw) {
+			render_switcher(P.desktops);
 		}
-		XSync(X.display, 0);
-		
-		if (commence_panel_redraw) {
-			render_panel(&P);
-		} else if (commence_switcher_redraw || commence_taskbar_redraw) {
-			if (commence_switcher_redraw) {
-				render_switcher(P.desktops);
-			}
-			if (commence_taskbar_redraw) {
-				render_taskbar(P.tasks, P.desktops);
-			}
-			render_present();
+		if (commence_taskbar_redraw) {
+			render_taskbar(&P.tasks, P.desktops);
 		}
-		commence_panel_redraw = 0;
-		commence_switcher_redraw = 0;
-		commence_taskbar_redraw = 0;
+		render_present();
+	} else if (commence_tasks_redraw) {
+		if (render_taskbar_dirty(&P.tasks, P.desktops) || commence_present)
+			render_present();
+	} else if (commence_present) {
+		render_present();
 	}
+
+	/* clock and icon loader frames have no events and aren't counted */
+	if (frame_batch)
+		perf_frame(frame_batch, commence_panel_redraw || 
+			   commence_switcher_redraw || commence_taskbar_redraw || 
+			   commence_tasks_redraw || commence_present);
+
+	/* nothing was presented, next frame's latency starts from scratch */
+	perf_input_dropped();
+
+	frame_batch = 0;
+	commence_panel_redraw = 0;
+	commence_switcher_redraw = 0;
+	commence_taskbar_redraw = 0;
+	commence_tasks_redraw = 0;
+	commence_present = 0;
+	if (!X.display)
+		return;
+
+	/* 
+	 * Flushes what we drew. Also, while we waited for property replies 
+	 * (fetch_stale_props and friends) XCB may have read events off the 
+	 * socket into its own queue, the connection fd won't wake us up for 
+	 * those. XPending looks at XCB's queue too, QueuedAlready wouldn't.
+	 */
+	if (XPending(X.display))
+		reactor_defer(xqueue_cb, 0);
 }
 
-static void clock_redraw_cb()
+static void arm_clock_timer()
 {
-	if (render_clock())
-		render_present();
+	struct itimerspec tspec;
+
+	memset(&tspec, 0, sizeof(tspec));
+	tspec.it_value.tv_sec = clocksched_next(time(0));
+	reactor_set_timer(clock_timer, REACTOR_TIMER_ABS | REACTOR_TIMER_CANCEL_ON_SET, 
+			  &tspec);
+}
+
+/* 
+ * One shot absolute timer on the next clock boundary (see clocksched.h). 
+ * Zero expirations mean someone (NTP, the user) set the clock, redraw and 
+ * rearm just the same. 
+ */
+static void clock_cb(uint64_t expirations, void *arg)
+{
+	TRACE_SCOPE("clock_cb");
+	if (render_clock()) {
+		commence_present = 1;
+		reactor_defer(frame_cb, 0);
+	}
+	arm_clock_timer();
+}
+
+static void iconload_cb(int fd, uint events, void *arg)
+{
+	apply_loaded_icons();
+	if (commence_tasks_redraw)
+		reactor_defer(frame_cb, 0);
+
+	/* 
+	 * The loader thread's property replies may have read our events into 
+	 * XCB's queue without waking up epoll, drain them now. 
+	 */
+	reactor_defer(xqueue_cb, 0);
 }
 
 /**************************************************************************
   signal handlers
 **************************************************************************/
 
-static void sighup_handler(int xxx)
+/* 
+ * Signals are blocked and read from a signalfd in the main loop, so the 
+ * handlers can do anything, including a proper cleanup. Blocked before any 
+ * thread is started, threads inherit the mask.
+ */
+static void init_signals()
 {
-	LOG_MESSAGE("sighup signal received");
-	cleanup();
-	xmemleaks();
-	exit(0);
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	if (sigprocmask(SIG_BLOCK, &mask, 0) == -1)
+		LOG_ERROR("failed to block signals");
+
+	sigfd = signalfd(-1, &mask, 0);
+	if (sigfd == -1)
+		LOG_ERROR("failed to create signal fd");
+	fcntl(sigfd, F_SETFL, O_NONBLOCK);
 }
 
-static void sigint_handler(int xxx)
+static void signal_cb(int fd, uint events, void *arg)
 {
-	LOG_MESSAGE("sigint signal received");
-	cleanup();
-	xmemleaks();
-	exit(0);
+	struct signalfd_siginfo si;
+
+	while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+		switch (si.ssi_signo) {
+		case SIGHUP:
+			LOG_MESSAGE("sighup signal received");
+			reactor_quit();
+			break;
+		case SIGINT:
+			LOG_MESSAGE("sigint signal received");
+			reactor_quit();
+			break;
+		case SIGUSR1:
+			perf_dump();
+			break;
+		case SIGUSR2:
+			trace_write();
+			break;
+		}
+	}
 }
 
 /**************************************************************************
@@ -1451,116 +1856,83 @@ static void list_themes()
   main event loop
 **************************************************************************/
 
-#if defined(WITH_EV)
-/* ---------- libev implementation ---------- */
-static void clock_redraw_cb_ev(EV_P_ struct ev_timer *w, int revents)
-{
-	clock_redraw_cb();
-}
-static void xconnection_cb_ev(EV_P_ struct ev_io *w, int revents)
-{
-	xconnection_cb();
-}
-
 static void init_and_start_loop()
 {
-	int xfd = ConnectionNumber(X.display);
-	struct ev_loop *el = ev_default_loop(0);
-	ev_timer clock_redraw;
-	ev_io xconnection;
-
-	/* macros?! whuut?! */
-	xconnection.active = xconnection.pending = xconnection.priority = 0;
-	xconnection.cb = xconnection_cb_ev;
-	xconnection.fd = xfd; 
-	xconnection.events = EV_READ | EV_IOFDSET;
-
-	clock_redraw.active = clock_redraw.pending = clock_redraw.priority = 0;
-	clock_redraw.cb = clock_redraw_cb_ev;
-	clock_redraw.at = clock_redraw.repeat = 1.0f;
+	if (reactor_init() == -1)
+		LOG_ERROR("failed to create epoll instance");
+
+	if (!reactor_add_fd(ConnectionNumber(X.display), REACTOR_READ, 
+			    xconnection_cb, 0))
+		LOG_ERROR("failed to watch X connection");
+	reactor_add_fd(sigfd, REACTOR_READ, signal_cb, 0);
+	if (iconload_fd() != -1)
+		reactor_add_fd(iconload_fd(), REACTOR_READ, iconload_cb, 0);
+
+	if (use_clock) {
+		clock_timer = reactor_add_timer(CLOCK_REALTIME, clock_cb, 0);
+		if (clock_timer)
+			arm_clock_timer();
+	}
 
-	ev_io_start(el, &xconnection);
-	ev_timer_start(el, &clock_redraw);
-	ev_loop(el, 0);
+	/* XSync in main could have queued some events already */
+	reactor_defer(xqueue_cb, 0);
+	reactor_run();
 }
-#elif defined(WITH_EVENT)
-/* ---------- libevent implementation ---------- */
-static void clock_redraw_cb_event(int fd, short type, void *arg)
-{
-	clock_redraw_cb();
-	
-	/* reschedule */
-	struct timeval tv = {1, 0};
-	event_add((struct event*)arg, &tv);
 
-}
-static void xconnection_cb_event(int fd, short type, void *arg)
+static double elapsed_ms(struct timeval *from, struct timeval *to)
 {
-	xconnection_cb();
-	
-	/* reschedule */
-	event_add((struct event*)arg, 0);
+	return (to->tv_sec - from->tv_sec) * 1000.0 + 
+		(to->tv_usec - from->tv_usec) / 1000.0;
 }
 
-static void init_and_start_loop()
-{
-	int xfd = ConnectionNumber(X.display);
-	struct event clock_redraw;
-	struct event xconnection;
-	struct timeval tv = {1, 0};
-
-	event_init();
-	event_set(&clock_redraw, -1, 0, clock_redraw_cb_event, &clock_redraw);
-	event_add(&clock_redraw, &tv); 
-
-	event_set(&xconnection, xfd, EV_READ, xconnection_cb_event, &xconnection);
-	event_add(&xconnection, 0);
-
-	event_dispatch();
-}
-#else
-/* ---------- glibc 2.8 + timerfd in linux kernel ---------- */
-static void init_and_start_loop()
+/* 
+ * Feeds a recording (see replay.h) through the handlers as fast as it can, 
+ * one frame per recorded frame, and reports what it cost. 
+ */
+static void replay_loop()
 {
-	fd_set events;
-	int maxfd;
-	int xfd;
-
-	/* get connection fd from Xlib */
-	xfd = ConnectionNumber(X.display);
-
-	/* create timer fd to deal with timer and connection in one thread */
-	timerfd = timerfd_create(CLOCK_MONOTONIC, 0);
-	if (timerfd == -1)
-		LOG_ERROR("failed to create timer fd");
-	fcntl(timerfd, F_SETFL, O_NONBLOCK);
-
-	maxfd = (timerfd > xfd) ? timerfd : xfd;
-
-	/* 1 second interval */
-	struct itimerspec tspec = {{1,0},{1,0}};
-	timerfd_settime(timerfd, 0, &tspec, 0);
-
-	while (1) {
-		FD_ZERO(&events);
-		FD_SET(xfd, &events);
-		FD_SET(timerfd, &events);
-
-		if (select(maxfd+1, &events, 0, 0, 0) == -1)
-			break;
-
-		if (FD_ISSET(xfd, &events)) 
-			xconnection_cb();
-		if (FD_ISSET(timerfd, &events)) {
-			uint64_t tmp = 0;
-			/* dump all stuff from timer fd to nowhere */
-			while (read(timerfd, &tmp, sizeof(uint64_t)) > 0)
-				/* do nothing */;
-			clock_redraw_cb();
+	static XEvent events[REPLAY_MAX_BATCH];
+	struct rusage ru0, ru1;
+	uint64_t t0 = perf_now();
+	uint allocs = xmemallocs();
+	uint nevents = 0, nframes = 0, skipped = 0;
+	int n, i, frame_end;
+
+	getrusage(RUSAGE_SELF, &ru0);
+	while ((n = replay_next_batch(events, REPLAY_MAX_BATCH, &frame_end)) > 0) {
+		for (i = 0; i < n; ++i) {
+			XEvent *e = &events[i];
+			PERF_COUNT_EVENT(e->type);
+			perf_input_arrived();
+			switch (e->type) {
+			case PropertyNotify:
+			case FocusIn:
+			case Expose:
+				handle_event(e);
+				break;
+			default:
+				/* these handlers talk to the server */
+				skipped++;
+				break;
+			}
+		}
+		nevents += n;
+		frame_batch += n;
+		if (frame_end) {
+			nframes++;
+			frame_cb(0);
 		}
 	}
+	getrusage(RUSAGE_SELF, &ru1);
+
+	LOG_MESSAGE("replay: %u events (%u skipped) in %u frames", 
+			nevents, skipped, nframes);
+	LOG_MESSAGE("replay: %.3f ms wall, %.3f ms user, %.3f ms system, %u allocations",
+			(perf_now() - t0) / 1000000.0,
+			elapsed_ms(&ru0.ru_utime, &ru1.ru_utime),
+			elapsed_ms(&ru0.ru_stime, &ru1.ru_stime),
+			xmemallocs() - allocs);
 }
-#endif
 
 static void parse_args(int argc, char **argv)
 {
@@ -1586,6 +1958,14 @@ static void parse_args(int argc, char **argv)
 			list_themes();
 			exit(0);
 		}
+		if (!strcmp(arg, "--record") && i + 1 < argc) {
+			record_file = argv[++i];
+			continue;
+		}
+		if (!strcmp(arg, "--replay") && i + 1 < argc) {
+			replay_file = argv[++i];
+			continue;
+		}
 		break;
 	}
 
@@ -1599,24 +1979,31 @@ int main(int argc, char **argv)
 	log_attach_callback(log_console_callback);
 	parse_args(argc, argv);
 	LOG_MESSAGE("starting bmpanel with theme: %s", theme);
+	init_signals();
 
 	initX();
 	initP(theme);
 	init_render(&X, &P);
-
-	signal(SIGHUP, sighup_handler);
-	signal(SIGINT, sigint_handler);
+	/* recording and replay need icons fetched in order, i.e. in place */
+	if (THEME_USE_TASKBAR_ICON(P.theme) && !record_file && !replay_file)
+		iconload_init(X.atoms[XATOM_NET_WM_ICON], 
+				P.theme->taskbar.icon_w, P.theme->taskbar.icon_h);
 
 	rebuild_desktops();
 	update_tasks();
 
-	render_update_panel_positions(&P);
+	render_update_panel_positions(&P, LAYOUT_ALL);
 	render_panel(&P);
 
-	XSync(X.display, 0);
-	init_and_start_loop();
+	if (replay_file) {
+		replay_loop();
+	} else {
+		XSync(X.display, 0);
+		init_and_start_loop();
+	}
 
 	cleanup();
+	xmemleaks();
 	return 0;
 }
 
@@ -17,20 +17,39 @@
 #include "common.h"
 
 struct task {
-	struct task *next;
 	char *name;
 	Window win;
 	Imlib_Image icon;
 	int posx;
 	int width;
 	int desktop;
+	uint slot; /* index in the bucket of its desktop */
+	uint state; /* WINSTATE_* bits, see winstate.h */
 	uint focused;
 	uint iconified;
+	uint dirty; /* button needs repaint (name, icon or state changed) */
+	uint stale; /* properties to fetch before the next frame */
+};
+
+/* tasks of one desktop in button order, see tasklist.h */
+struct task_bucket {
+	struct task **tasks;
+	uint count;
+	uint alloc;
+};
+
+struct tasklist {
+	struct task_bucket sticky;	/* desktop -1, visible everywhere */
+	struct task_bucket nowhere;	/* desktop numbers we can't show */
+	struct task_bucket *desktops;
+	uint desktopsnum;
+	uint count;
 };
 
 struct desktop {
 	struct desktop *next;
 	char *name;
+	int textw; /* width of the name in switcher font, -1 if not measured */
 	int posx;
 	int width;
 	uint focused;
@@ -45,7 +64,7 @@ struct tray {
 
 struct panel {
 	Window win;
-	struct task *tasks;
+	struct tasklist tasks;
 	struct desktop *desktops;
 	struct theme *theme;
 	struct tray *trayicons;
@@ -83,6 +102,15 @@ enum {
 	XATOM_UTF8_STRING,
 	XATOM_MOTIF_WM_HINTS,
 	XATOM_XROOTPMAP_ID,
+	XATOM_NET_WM_STATE_SKIP_PAGER,
+	XATOM_NET_WM_STATE_DEMANDS_ATTENTION,
+	XATOM_NET_WM_STATE_FULLSCREEN,
+	XATOM_NET_WM_STATE_MAXIMIZED_VERT,
+	XATOM_NET_WM_STATE_MAXIMIZED_HORZ,
+	XATOM_NET_WM_STATE_ABOVE,
+	XATOM_NET_WM_STATE_BELOW,
+	XATOM_NET_WM_STATE_STICKY,
+	XATOM_NET_WM_STATE_MODAL,
 	XATOM_COUNT
 };
 
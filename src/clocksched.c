@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <string.h>
+#include "logger.h"
+#include "clocksched.h"
+
+enum {
+	CLOCK_SECOND,
+	CLOCK_MINUTE,
+	CLOCK_HOUR,
+	CLOCK_DAY
+};
+
+static const int unit_seconds[] = {1, 60, 3600, 86400};
+
+static int unit = CLOCK_SECOND;
+
+static int conversion_unit(char c)
+{
+	switch (c) {
+	/* seconds, or composites containing them */
+	case 'S': case 's': case 'T': case 'r': case 'c': case 'X': case '+':
+		return CLOCK_SECOND;
+	case 'M': case 'R':
+		return CLOCK_MINUTE;
+	/* time zone name and offset change on DST switch, which is on the hour */
+	case 'H': case 'I': case 'k': case 'l': case 'p': case 'P':
+	case 'Z': case 'z':
+		return CLOCK_HOUR;
+	case 'a': case 'A': case 'b': case 'B': case 'h': case 'C': case 'd':
+	case 'D': case 'e': case 'F': case 'g': case 'G': case 'j': case 'm':
+	case 'u': case 'U': case 'V': case 'w': case 'W': case 'x': case 'y':
+	case 'Y': case 'n': case 't': case '%':
+		return CLOCK_DAY;
+	}
+	return CLOCK_SECOND;
+}
+
+void clocksched_init(const char *format)
+{
+	const char *p = format;
+
+	unit = CLOCK_DAY;
+	while ((p = strchr(p, '%')) != 0) {
+		p++;
+		/* glibc flags and field width: %-d, %_H, %02M, ... */
+		while (*p && strchr("_-0^#123456789", *p))
+			p++;
+		/* E and O modifiers: %Ey, %OH */
+		if (*p == 'E' || *p == 'O')
+			p++;
+		if (!*p) {
+			unit = CLOCK_SECOND;
+			break;
+		}
+		int u = conversion_unit(*p++);
+		if (u < unit)
+			unit = u;
+	}
+
+	LOG_INFO("clock format \"%s\" changes every %d seconds", format,
+			unit_seconds[unit]);
+}
+
+time_t clocksched_next(time_t now)
+{
+	struct tm tm;
+	time_t next;
+
+	if (unit == CLOCK_SECOND)
+		return now + 1;
+
+	/* 
+	 * Boundaries are in local time: hours and days don't line up with the 
+	 * epoch in zones like +05:30, and mktime takes care of DST. 
+	 */
+	localtime_r(&now, &tm);
+	tm.tm_sec = 0;
+	switch (unit) {
+	case CLOCK_MINUTE:
+		tm.tm_min++;
+		break;
+	case CLOCK_HOUR:
+		tm.tm_min = 0;
+		tm.tm_hour++;
+		break;
+	case CLOCK_DAY:
+		tm.tm_min = 0;
+		tm.tm_hour = 0;
+		tm.tm_mday++;
+		break;
+	}
+	tm.tm_isdst = -1;
+	next = mktime(&tm);
+
+	/* shouldn't happen, but never spin and never sleep for days */
+	if (next <= now || next - now > unit_seconds[unit] + 3600)
+		return now + 1;
+	return next;
+}
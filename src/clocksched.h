@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_CLOCKSCHED_H
+#define BMPANEL_CLOCKSCHED_H
+
+#include <time.h>
+
+/*
+ * Clock scheduler. Looks at the strftime format of the clock and figures out
+ * the smallest unit of time it shows (second, minute, hour or day). The event
+ * loop then sleeps until the next boundary of that unit instead of waking up
+ * every second and redrawing the same string.
+ *
+ * Unknown conversions are treated as "changes every second", so a weird
+ * format costs wakeups, never a stale clock.
+ */
+
+void clocksched_init(const char *format);
+
+/* the next moment (wall clock, seconds) the formatted string can change */
+time_t clocksched_next(time_t now);
+
+#endif
@@ -8,6 +8,7 @@
 #include "common.h"
 
 static int memleaks;
+static uint memallocs;
 
 #ifndef MEMDEBUG
 /**************************************************************************
@@ -21,6 +22,7 @@ void *impl__xmalloc(size_t size)
 		LOG_ERROR("common: out of memory, malloc failed >:-O");
 
 	memleaks++;
+	memallocs++;
 	return ret;
 }
 
@@ -76,6 +78,7 @@ void *impl__xmalloc(size_t size, const char *file, uint line)
 
 	add_mem_entry(ret, size, file, line);
 	memleaks++;
+	memallocs++;
 	return ret;
 }
 
@@ -159,3 +162,7 @@ void xmemleaks()
 }
 #endif
 
+uint xmemallocs()
+{
+	return memallocs;
+}
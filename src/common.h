@@ -46,6 +46,8 @@ typedef unsigned long long 	ulonglong;
 #endif
 
 void xmemleaks();
+/* total number of allocations so far */
+uint xmemallocs();
 
 #define XMALLOC(type, n) xmalloc(sizeof(type) * (n))
 #define XMALLOCZ(type, n) xmallocz(sizeof(type) * (n))
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <string.h>
+#include "logger.h"
+#include "iconcache.h"
+#include "iconscale.h"
+#include "perf.h"
+
+/* unreferenced icons are evicted when all the icons take more than this */
+#define ICONCACHE_MAX_BYTES (256 * 1024)
+
+struct icon_entry {
+	Imlib_Image img;
+	uint64_t hash;
+	int srcw;
+	int srch;
+	uint refs;
+	uint used;
+};
+
+static struct icon_entry *entries;
+static uint count;
+static uint alloc;
+
+static int iconw;
+static int iconh;
+static uint bytes;
+
+static uint tick;
+static uint hits;
+static uint misses;
+static uint evictions;
+static void (*evict)(Imlib_Image);
+
+uint64_t iconcache_hash(const uint32_t *data, uint n)
+{
+	/* FNV-1a, a word at a time */
+	uint64_t h = 14695981039346656037ULL;
+	uint i;
+	for (i = 0; i < n; ++i) {
+		h ^= data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static uint icon_bytes()
+{
+	return iconw * iconh * sizeof(uint32_t);
+}
+
+static void free_entry(uint i)
+{
+	struct icon_entry *e = &entries[i];
+	if (evict)
+		evict(e->img);
+	imlib_context_set_image(e->img);
+	imlib_free_image();
+	bytes -= icon_bytes();
+
+	*e = entries[--count];
+}
+
+/* drops least recently used unreferenced icons until we fit the cap */
+static void shrink()
+{
+	while (bytes > ICONCACHE_MAX_BYTES) {
+		int victim = -1;
+		uint i;
+		for (i = 0; i < count; ++i) {
+			if (entries[i].refs)
+				continue;
+			if (victim == -1 || entries[i].used < entries[victim].used)
+				victim = i;
+		}
+		if (victim == -1)
+			return;
+		free_entry(victim);
+		evictions++;
+	}
+}
+
+static struct icon_entry *new_entry()
+{
+	if (count == alloc) {
+		uint newalloc = alloc ? alloc * 2 : 32;
+		struct icon_entry *newentries = XMALLOC(struct icon_entry, newalloc);
+		if (count)
+			memcpy(newentries, entries, sizeof(struct icon_entry) * count);
+		if (entries)
+			xfree(entries);
+		entries = newentries;
+		alloc = newalloc;
+	}
+	return &entries[count++];
+}
+
+static Imlib_Image scale_icon(const uint32_t *data, int w, int h)
+{
+	Imlib_Image img;
+
+	/* already scaled (by the icon loader) */
+	if (w == iconw && h == iconh) {
+		img = imlib_create_image_using_copied_data(w, h, (DATA32*)data);
+		if (!img)
+			return 0;
+		imlib_context_set_image(img);
+		imlib_image_set_has_alpha(1);
+		return img;
+	}
+
+	/* downscaling is the usual case, do it ourselves in one pass */
+	if (w >= iconw && h >= iconh) {
+		img = imlib_create_image(iconw, iconh);
+		if (!img)
+			return 0;
+		imlib_context_set_image(img);
+		imlib_image_set_has_alpha(1);
+		DATA32 *dst = imlib_image_get_data();
+		icon_downscale(data, w, h, dst, iconw, iconh);
+		imlib_image_put_back_data(dst);
+		return img;
+	}
+
+	Imlib_Image src = imlib_create_image_using_copied_data(w, h, (DATA32*)data);
+	if (!src)
+		return 0;
+	imlib_context_set_image(src);
+	imlib_image_set_has_alpha(1);
+	img = imlib_create_cropped_scaled_image(0, 0, w, h, iconw, iconh);
+	imlib_free_image();
+	if (!img)
+		return 0;
+	imlib_context_set_image(img);
+	imlib_image_set_has_alpha(1);
+	return img;
+}
+
+void iconcache_init(int w, int h, void (*evict_cb)(Imlib_Image))
+{
+	iconw = w;
+	iconh = h;
+	evict = evict_cb;
+	hits = misses = evictions = 0;
+}
+
+void iconcache_shutdown()
+{
+	uint refs = 0, i;
+	for (i = 0; i < count; ++i)
+		refs += entries[i].refs;
+
+	LOG_INFO("icon cache: %u hits, %u misses, %u evictions, "
+		 "%u icons (%u bytes) shared by %u tasks", 
+		 hits, misses, evictions, count, bytes, refs);
+
+	while (count)
+		free_entry(count - 1);
+	if (entries)
+		xfree(entries);
+	entries = 0;
+	alloc = 0;
+	evict = 0;
+}
+
+Imlib_Image iconcache_get_hashed(uint64_t hash, int srcw, int srch, 
+		const uint32_t *data, int w, int h)
+{
+	struct icon_entry *e;
+	uint i;
+
+	for (i = 0; i < count; ++i) {
+		e = &entries[i];
+		if (e->hash == hash && e->srcw == srcw && e->srch == srch) {
+			hits++;
+			e->refs++;
+			e->used = ++tick;
+			return e->img;
+		}
+	}
+
+	misses++;
+	PERF_COUNT(PERF_ICON_DECODES);
+	Imlib_Image img = scale_icon(data, w, h);
+	if (!img)
+		return 0;
+
+	e = new_entry();
+	e->img = img;
+	e->hash = hash;
+	e->srcw = srcw;
+	e->srch = srch;
+	e->refs = 1;
+	e->used = ++tick;
+	bytes += icon_bytes();
+
+	shrink();
+	return img;
+}
+
+Imlib_Image iconcache_get(const uint32_t *data, int w, int h)
+{
+	return iconcache_get_hashed(iconcache_hash(data, w * h), w, h, data, w, h);
+}
+
+void iconcache_release(Imlib_Image img)
+{
+	uint i;
+	for (i = 0; i < count; ++i) {
+		if (entries[i].img == img) {
+			entries[i].refs--;
+			break;
+		}
+	}
+	shrink();
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_ICONCACHE_H
+#define BMPANEL_ICONCACHE_H
+
+#include <stdint.h>
+#include <Imlib2.h>
+#include "common.h"
+
+/*
+ * Scaled task icons shared between windows. Icons are looked up by a hash 
+ * of their source pixels, so identical icons (forty terminals) are scaled 
+ * once and the same image is handed out to every task. Images are 
+ * refcounted, unreferenced ones stay cached until the memory cap pushes 
+ * them out, least recently used first.
+ */
+
+void iconcache_init(int w, int h, void (*evict_cb)(Imlib_Image));
+void iconcache_shutdown();
+
+/* 'data' is w * h ARGB pixels, returns scaled icon and takes a reference */
+Imlib_Image iconcache_get(const uint32_t *data, int w, int h);
+
+/* 
+ * Same, but the source image was hashed beforehand and 'data' may be scaled 
+ * already (w, h is its size then). Hashing is thread-safe, the rest isn't.
+ */
+uint64_t iconcache_hash(const uint32_t *data, uint n);
+Imlib_Image iconcache_get_hashed(uint64_t hash, int srcw, int srch, 
+		const uint32_t *data, int w, int h);
+void iconcache_release(Imlib_Image img);
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <X11/Xatom.h>
+#include <sys/eventfd.h>
+#include "logger.h"
+#include "xprop.h"
+#include "iconcache.h"
+#include "iconscale.h"
+#include "iconload.h"
+#include "trace.h"
+
+/* 
+ * _NET_WM_ICON is a list of images, each is width, height and pixels. Apps 
+ * ship whole icon sets there (up to 512x512), so only the beginning of the 
+ * property is requested first. The rest of the headers are read one by one 
+ * and only the pixels of the image closest to the theme icon size are 
+ * fetched.
+ */
+#define ICON_CHUNK 1024
+#define ICON_MAX_IMAGES 32
+#define ICON_MAX_SIZE 4096
+
+/* 
+ * Jobs and results cross threads, they use plain malloc/free: x* memory 
+ * routines keep leak counters without any locking.
+ */
+
+struct icon_job {
+	struct icon_job *next;
+	Window win;
+};
+
+static Atom atom;
+static uint32_t iconw;
+static uint32_t iconh;
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static int running;
+static int quit;
+static int efd = -1;
+
+/* both are FIFOs, guarded by 'lock' */
+static struct icon_job *jobs, *lastjob;
+static struct icon_result *results, *lastresult;
+
+/**************************************************************************
+  fetching (runs on the worker)
+**************************************************************************/
+
+/* the smallest image not smaller than the theme icon, or the biggest one */
+static int icon_size_better(uint32_t w, uint32_t h, uint32_t bestw, uint32_t besth)
+{
+	int big = (w >= iconw && h >= iconh);
+	int bestbig = (bestw >= iconw && besth >= iconh);
+	if (big != bestbig)
+		return big;
+	return big ? w * h < bestw * besth : w * h > bestw * besth;
+}
+
+static void set_result_pixels(struct icon_result *r, const uint32_t *src, 
+		uint32_t w, uint32_t h)
+{
+	r->hash = iconcache_hash(src, w * h);
+	r->srcw = w;
+	r->srch = h;
+
+	if (w >= iconw && h >= iconh) {
+		r->w = iconw;
+		r->h = iconh;
+		r->pixels = malloc(sizeof(uint32_t) * iconw * iconh);
+		if (r->pixels)
+			icon_downscale(src, w, h, r->pixels, iconw, iconh);
+	} else {
+		r->w = w;
+		r->h = h;
+		r->pixels = malloc(sizeof(uint32_t) * w * h);
+		if (r->pixels)
+			memcpy(r->pixels, src, sizeof(uint32_t) * w * h);
+	}
+}
+
+static void fetch_icon(struct icon_result *r)
+{
+	TRACE_SCOPE("fetch_icon");
+	struct xprop first, p;
+	int num = 0, n, images = 0;
+
+	xprop_request_range(&first, r->win, atom, XA_CARDINAL, 0, ICON_CHUNK);
+	uint32_t *data = xprop_data(&first, &num);
+	if (!data || num < 2) {
+		xprop_release(&first);
+		return;
+	}
+
+	uint32_t total = num + xprop_bytes_after(&first) / 4;
+	uint32_t off = 0, best = 0, bestw = 0, besth = 0;
+	while (off + 2 <= total && images++ < ICON_MAX_IMAGES) {
+		uint32_t w, h;
+		if (off + 2 <= (uint32_t)num) {
+			w = data[off];
+			h = data[off+1];
+		} else {
+			xprop_request_range(&p, r->win, atom, XA_CARDINAL, off, 2);
+			uint32_t *hdr = xprop_data(&p, &n);
+			w = (hdr && n == 2) ? hdr[0] : 0;
+			h = (hdr && n == 2) ? hdr[1] : 0;
+			xprop_release(&p);
+		}
+		if (!w || !h || w > ICON_MAX_SIZE || h > ICON_MAX_SIZE || 
+		    w * h > total - off - 2)
+			break;
+		if (!bestw || icon_size_better(w, h, bestw, besth)) {
+			best = off;
+			bestw = w;
+			besth = h;
+		}
+		off += 2 + w * h;
+	}
+
+	if (!bestw) {
+		xprop_release(&first);
+		return;
+	}
+
+	/* got it already? */
+	if (best + 2 + bestw * besth <= (uint32_t)num) {
+		set_result_pixels(r, data + best + 2, bestw, besth);
+		xprop_release(&first);
+		return;
+	}
+	xprop_release(&first);
+
+	xprop_request_range(&p, r->win, atom, XA_CARDINAL, best + 2, bestw * besth);
+	uint32_t *pixels = xprop_data(&p, &n);
+	if (pixels && (uint32_t)n == bestw * besth)
+		set_result_pixels(r, pixels, bestw, besth);
+	xprop_release(&p);
+}
+
+static void push_result(struct icon_result *r)
+{
+	if (lastresult)
+		lastresult->next = r;
+	else
+		results = r;
+	lastresult = r;
+}
+
+static void *worker_main(void *arg)
+{
+	struct icon_job *job;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!jobs && !quit)
+			pthread_cond_wait(&wakeup, &lock);
+		if (quit)
+			break;
+
+		job = jobs;
+		jobs = job->next;
+		if (!jobs)
+			lastjob = 0;
+		pthread_mutex_unlock(&lock);
+
+		struct icon_result *r = calloc(1, sizeof(struct icon_result));
+		if (r) {
+			r->win = job->win;
+			fetch_icon(r);
+		}
+		free(job);
+
+		pthread_mutex_lock(&lock);
+		if (r)
+			push_result(r);
+		if (write(efd, &one, sizeof(one)) != sizeof(one))
+			LOG_WARNING("failed to signal icon loader eventfd");
+	}
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+/**************************************************************************
+  interface (main thread)
+**************************************************************************/
+
+int iconload_init(Atom net_wm_icon, int w, int h)
+{
+	atom = net_wm_icon;
+	iconw = w;
+	iconh = h;
+	quit = 0;
+
+	efd = eventfd(0, 0);
+	if (efd == -1) {
+		LOG_WARNING("failed to create eventfd, icons will be loaded in place");
+		return -1;
+	}
+	fcntl(efd, F_SETFL, O_NONBLOCK);
+
+	if (pthread_create(&worker, 0, worker_main, 0)) {
+		LOG_WARNING("failed to start icon loader thread, icons will be loaded in place");
+		close(efd);
+		efd = -1;
+		return -1;
+	}
+	running = 1;
+	return efd;
+}
+
+void iconload_shutdown()
+{
+	struct icon_job *job;
+	struct icon_result *r;
+
+	if (running) {
+		pthread_mutex_lock(&lock);
+		quit = 1;
+		pthread_cond_signal(&wakeup);
+		pthread_mutex_unlock(&lock);
+		pthread_join(worker, 0);
+		running = 0;
+	}
+
+	while (jobs) {
+		job = jobs;
+		jobs = job->next;
+		free(job);
+	}
+	lastjob = 0;
+
+	while ((r = iconload_collect())) {
+		struct icon_result *next;
+		for (; r; r = next) {
+			next = r->next;
+			iconload_free_result(r);
+		}
+	}
+
+	if (efd != -1)
+		close(efd);
+	efd = -1;
+}
+
+int iconload_fd()
+{
+	return efd;
+}
+
+int iconload_request(Window win)
+{
+	if (!running) {
+		struct icon_result *r = calloc(1, sizeof(struct icon_result));
+		if (!r)
+			LOG_ERROR("iconload: out of memory");
+		r->win = win;
+		fetch_icon(r);
+		push_result(r);
+		return 0;
+	}
+
+	struct icon_job *job = calloc(1, sizeof(struct icon_job));
+	if (!job)
+		LOG_ERROR("iconload: out of memory");
+	job->win = win;
+
+	pthread_mutex_lock(&lock);
+	if (lastjob)
+		lastjob->next = job;
+	else
+		jobs = job;
+	lastjob = job;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&lock);
+	return 1;
+}
+
+struct icon_result *iconload_collect()
+{
+	struct icon_result *ret;
+	uint64_t tmp;
+
+	if (efd != -1) {
+		/* reset the counter, we take everything anyway */
+		while (read(efd, &tmp, sizeof(tmp)) > 0)
+			/* do nothing */;
+	}
+
+	pthread_mutex_lock(&lock);
+	ret = results;
+	results = lastresult = 0;
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+void iconload_free_result(struct icon_result *r)
+{
+	if (r->pixels)
+		free(r->pixels);
+	free(r);
+}
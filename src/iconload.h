@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_ICONLOAD_H
+#define BMPANEL_ICONLOAD_H
+
+#include <stdint.h>
+#include <X11/Xlib.h>
+#include "common.h"
+
+/*
+ * _NET_WM_ICON fetching and scaling on a worker thread. The worker talks to 
+ * the X server through XCB only (see xprop.h) and never touches Imlib. 
+ * Finished icons are collected by the main loop when iconload_fd() becomes 
+ * readable (eventfd), turning them into images is up to the main thread.
+ *
+ * Xlib must be initialized with XInitThreads(), XCB requests from the 
+ * worker make Xlib give away its socket from that thread.
+ */
+
+struct icon_result {
+	struct icon_result *next;
+	Window win;
+	uint64_t hash;	/* source image hash, see iconcache_hash() */
+	int srcw;	/* source image size */
+	int srch;
+	uint32_t *pixels; /* 0 if the window has no usable _NET_WM_ICON */
+	int w;		/* size of 'pixels', already scaled if it was a downscale */
+	int h;
+};
+
+/* returns -1 if the worker can't be started, icons are loaded in place then */
+int iconload_init(Atom net_wm_icon, int iconw, int iconh);
+void iconload_shutdown();
+
+/* eventfd which becomes readable when there are results */
+int iconload_fd();
+
+/* 
+ * Queues icon loading for a window. Returns 0 if it was done right away 
+ * (no worker), the result is waiting in iconload_collect() then.
+ */
+int iconload_request(Window win);
+
+/* takes all the finished results, in request order */
+struct icon_result *iconload_collect();
+void iconload_free_result(struct icon_result *r);
+
+#endif
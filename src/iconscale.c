@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+/* 
+ * SSE2 is always there on x86_64, AVX2 is picked at run time. Built with 
+ * target attributes, so it doesn't need -mavx2 and the binary still runs on 
+ * CPUs without it.
+ */
+#if defined(__SSE2__) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+ #define ICONSCALE_X86
+ #include <immintrin.h>
+#endif
+#include <string.h>
+#include "iconscale.h"
+
+/* 
+ * Row sums are (blue * alpha, green * alpha, red * alpha, alpha), it's the 
+ * same layout as ARGB pixel bytes in memory. A row is at most 4096 pixels 
+ * (see get_net_wm_icon), so 32 bit sums are enough.
+ */
+
+static void sum_row_scalar(const uint32_t *p, int n, uint32_t *acc)
+{
+	int i;
+	for (i = 0; i < n; ++i) {
+		uint32_t px = p[i];
+		uint32_t a = px >> 24;
+		acc[0] += (px & 0xFF) * a;
+		acc[1] += ((px >> 8) & 0xFF) * a;
+		acc[2] += ((px >> 16) & 0xFF) * a;
+		acc[3] += a;
+	}
+}
+
+#if defined(ICONSCALE_X86)
+
+/* four pixels at a time, 16 bit lanes, two pixels per 128 bit half */
+__attribute__((target("avx2")))
+static void sum_row_avx2(const uint32_t *p, int n, uint32_t *acc)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1);
+	__m256i sum = zero;
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m256i px = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(p + i)));
+		__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, 0xFF), 0xFF);
+		/* colors are multiplied by alpha, alpha by one */
+		a = _mm256_blend_epi16(a, one, 0x88);
+		px = _mm256_mullo_epi16(px, a);
+		sum = _mm256_add_epi32(sum, _mm256_unpacklo_epi16(px, zero));
+		sum = _mm256_add_epi32(sum, _mm256_unpackhi_epi16(px, zero));
+	}
+
+	uint32_t tmp[4];
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), 
+			_mm256_extracti128_si256(sum, 1));
+	_mm_storeu_si128((__m128i*)tmp, s);
+	/* 
+	 * GCC turns the call below into a tail jump without vzeroupper, the 
+	 * dirty upper halves then slow down every SSE instruction after us. 
+	 */
+	_mm256_zeroupper();
+	acc[0] += tmp[0]; acc[1] += tmp[1];
+	acc[2] += tmp[2]; acc[3] += tmp[3];
+	sum_row_scalar(p + i, n - i, acc);
+}
+
+/* two pixels at a time, 16 bit lanes */
+static void sum_row_sse2(const uint32_t *p, int n, uint32_t *acc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i sum = zero;
+	int i = 0;
+
+	for (; i + 2 <= n; i += 2) {
+		__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + i)), zero);
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xFF), 0xFF);
+		/* colors are multiplied by alpha, alpha by one */
+		a = _mm_or_si128(_mm_andnot_si128(amask, a), _mm_and_si128(amask, one));
+		px = _mm_mullo_epi16(px, a);
+		sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(px, zero));
+		sum = _mm_add_epi32(sum, _mm_unpackhi_epi16(px, zero));
+	}
+
+	uint32_t tmp[4];
+	_mm_storeu_si128((__m128i*)tmp, sum);
+	acc[0] += tmp[0]; acc[1] += tmp[1];
+	acc[2] += tmp[2]; acc[3] += tmp[3];
+	sum_row_scalar(p + i, n - i, acc);
+}
+
+#endif
+
+static const struct {
+	const char *name;
+	void (*sum_row)(const uint32_t *p, int n, uint32_t *acc);
+} kernels[] = {
+#if defined(ICONSCALE_X86)
+	{"avx2", sum_row_avx2},
+	{"sse2", sum_row_sse2},
+#endif
+	{"scalar", sum_row_scalar}
+};
+
+static int kernel_supported(int k)
+{
+#if defined(ICONSCALE_X86)
+	if (kernels[k].sum_row == sum_row_avx2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return 1;
+}
+
+static int kernel = -1;
+
+/* 
+ * Picked before main(), the icon loader thread and the main thread both 
+ * downscale and neither has to care. 
+ */
+__attribute__((constructor))
+static void pick_kernel()
+{
+	int k;
+#if defined(ICONSCALE_X86)
+	__builtin_cpu_init();
+#endif
+	for (k = 0; !kernel_supported(k); ++k)
+		;
+	kernel = k;
+}
+
+const char *icon_downscale_kernel()
+{
+	return kernels[kernel].name;
+}
+
+int icon_downscale_use(const char *name)
+{
+	int k;
+	for (k = 0; k < (int)ARRAY_LENGTH(kernels); ++k) {
+		if (!strcmp(kernels[k].name, name) && kernel_supported(k)) {
+			kernel = k;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void icon_downscale(const uint32_t *src, int sw, int sh, uint32_t *dst, int dw, int dh)
+{
+	void (*sum_row)(const uint32_t*, int, uint32_t*) = kernels[kernel].sum_row;
+	int x, y, r, k;
+
+	if (sw == dw && sh == dh) {
+		memcpy(dst, src, sizeof(uint32_t) * dw * dh);
+		return;
+	}
+
+	for (y = 0; y < dh; ++y) {
+		int y0 = y * sh / dh;
+		int y1 = (y + 1) * sh / dh;
+		for (x = 0; x < dw; ++x) {
+			int x0 = x * sw / dw;
+			int x1 = (x + 1) * sw / dw;
+			uint64_t acc[4] = {0, 0, 0, 0};
+
+			for (r = y0; r < y1; ++r) {
+				uint32_t row[4] = {0, 0, 0, 0};
+				sum_row(src + r * sw + x0, x1 - x0, row);
+				for (k = 0; k < 4; ++k)
+					acc[k] += row[k];
+			}
+
+			if (!acc[3]) {
+				*dst++ = 0;
+				continue;
+			}
+
+			/* back from premultiplied */
+			uint64_t n = (uint64_t)(x1 - x0) * (y1 - y0);
+			uint32_t px = (uint32_t)((acc[3] + n / 2) / n) << 24;
+			for (k = 0; k < 3; ++k)
+				px |= (uint32_t)((acc[k] + acc[3] / 2) / acc[3]) << (k * 8);
+			*dst++ = px;
+		}
+	}
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_ICONSCALE_H
+#define BMPANEL_ICONSCALE_H
+
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Box filter downscaling of ARGB icons. Each destination pixel is the 
+ * average of its box of source pixels, weighted by alpha (colors are 
+ * premultiplied while summing), so transparent pixels don't darken the 
+ * edges. Source must be at least as big as destination in both dimensions.
+ */
+
+void icon_downscale(const uint32_t *src, int sw, int sh, uint32_t *dst, int dw, int dh);
+
+/* 
+ * Row summing kernel, the best one the CPU supports is picked at startup: 
+ * "avx2", "sse2" or "scalar". icon_downscale_use() switches to another one 
+ * (for benchmarks), returns -1 if the CPU can't run it. 
+ */
+const char *icon_downscale_kernel();
+int icon_downscale_use(const char *kernel);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <string.h>
+#include "layout.h"
+
+void layout_init(struct layout *l, const char *elements, int width, int separator)
+{
+	memset(l, 0, sizeof(struct layout));
+	l->elements = elements;
+	l->width = width;
+	l->separator = separator;
+}
+
+static struct layout_box *get_box(struct layout *l, char e, uint *bit)
+{
+	switch (e) {
+	case 'c': *bit = LAYOUT_CLOCK; return &l->clock;
+	case 's': *bit = LAYOUT_SWITCHER; return &l->switcher;
+	case 't': *bit = LAYOUT_TRAY; return &l->tray;
+	case 'b': *bit = LAYOUT_TASKBAR; return &l->taskbar;
+	}
+	*bit = 0;
+	return 0;
+}
+
+uint layout_arrange(struct layout *l)
+{
+	const char *e;
+	struct layout_box *b;
+	uint bit, changed = 0;
+	int ox = 0;
+
+	/* figure out taskbar width */
+	for (e = l->elements; *e; ++e) {
+		b = get_box(l, *e, &bit);
+		/* we're skipping if no tray icons here, separator is being drawn only once */
+		if (bit == LAYOUT_TRAY && !b->w)
+			continue;
+		if (bit == LAYOUT_TASKBAR)
+			continue;
+		if (b)
+			ox += b->w;
+		ox += l->separator;
+	}
+	if (l->taskbar.w != l->width - ox)
+		changed |= LAYOUT_TASKBAR;
+	l->taskbar.w = l->width - ox;
+
+	/* now positions */
+	ox = 0;
+	for (e = l->elements; *e; ++e) {
+		b = get_box(l, *e, &bit);
+		if (bit == LAYOUT_TRAY && !b->w)
+			continue;
+		if (b) {
+			if (b->x != ox)
+				changed |= bit;
+			b->x = ox;
+			ox += b->w;
+		}
+		if (e[1])
+			ox += l->separator;
+	}
+	return changed;
+}
+
+void layout_row_init(struct layout_row *r, int count, int x, int width, int sep)
+{
+	r->x = x;
+	r->width = width;
+	r->sep = sep;
+	r->count = count;
+	r->buttonw = count ? width / count - sep : 0;
+}
+
+int layout_row_place(struct layout_row *r, int i, struct layout_box *b)
+{
+	int x = r->x + i * (r->buttonw + r->sep);
+	int w = r->buttonw;
+
+	/* the last button fills empty space in the end of the task bar */
+	if (i == r->count - 1)
+		w = r->x + r->width - x;
+
+	if (b->x == x && b->w == w)
+		return 0;
+	b->x = x;
+	b->w = w;
+	return 1;
+}
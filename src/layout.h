@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_LAYOUT_H
+#define BMPANEL_LAYOUT_H
+
+#include "common.h"
+
+/* 
+ * Panel layout. Elements keep their widths between passes, only elements
+ * marked invalid are measured again. Knows nothing about themes or X, so 
+ * it can be driven by synthetic data.
+ */
+
+enum {
+	LAYOUT_CLOCK	= 1 << 0,
+	LAYOUT_SWITCHER	= 1 << 1,
+	LAYOUT_TRAY	= 1 << 2,
+	LAYOUT_TASKBAR	= 1 << 3,
+	LAYOUT_ALL	= (1 << 4) - 1
+};
+
+struct layout_box {
+	int x;
+	int w;
+};
+
+struct layout {
+	const char *elements; /* theme element string, e.g. "sbtc" */
+	int width;	/* panel width */
+	int separator;	/* separator width between elements */
+
+	/* taskbar width is computed, others are set by the caller */
+	struct layout_box clock;
+	struct layout_box switcher;
+	struct layout_box tray;
+	struct layout_box taskbar;
+};
+
+void layout_init(struct layout *l, const char *elements, int width, int separator);
+
+/* 
+ * Positions elements, taskbar takes the space left by the others. Tray 
+ * with zero width is skipped along with its separator. Returns LAYOUT_* bits 
+ * of boxes which moved or resized since the previous call.
+ */
+uint layout_arrange(struct layout *l);
+
+/* 
+ * A row of 'count' equal buttons in [x, x + width), 'sep' apart (task bar). 
+ * The last button also takes the space left over by the division.
+ */
+struct layout_row {
+	int x;
+	int width;
+	int sep;
+	int count;
+	int buttonw;	/* set by layout_row_init */
+};
+
+void layout_row_init(struct layout_row *r, int count, int x, int width, int sep);
+
+/* returns 1 if the box of the i-th button moved or resized */
+int layout_row_place(struct layout_row *r, int i, struct layout_box *b);
+
+#endif
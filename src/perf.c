@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <time.h>
+#include "logger.h"
+#include "perf.h"
+
+/* 
+ * Bucket i holds samples below 2^i units (microseconds for latencies), the 
+ * last one the rest. Totals are kept in finer units (nanoseconds), 'scale' 
+ * per histogram converts them. 
+ */
+#define PERF_BUCKETS 24
+
+struct histogram {
+	uint64_t buckets[PERF_BUCKETS];
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+};
+
+uint64_t perf_counters[PERF_COUNTERS];
+uint64_t perf_events[PERF_EVENT_TYPES + 1];
+
+static struct histogram hists[PERF_HISTS];
+static uint64_t input_since;
+
+static const char *counter_names[PERF_COUNTERS] = {
+	"property fetches",
+	"layouts",
+	"full renders",
+	"partial renders",
+	"bytes presented",
+	"icon decodes",
+	"frames",
+	"events folded",
+	"events dropped"
+};
+
+static const struct {
+	const char *name;
+	const char *unit;
+	uint64_t scale;
+} hist_info[PERF_HISTS] = {
+	{"event -> present", "us", 1000},
+	{"render_taskbar", "us", 1000},
+	{"render_switcher", "us", 1000},
+	{"render_clock", "us", 1000},
+	{"render_present", "us", 1000},
+	{"events per frame", "", 1}
+};
+
+/* see X11/X.h */
+static const char *event_names[] = {
+	0, 0, "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease", 
+	"MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut", 
+	"KeymapNotify", "Expose", "GraphicsExpose", "NoExpose", 
+	"VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify", 
+	"MapNotify", "MapRequest", "ReparentNotify", "ConfigureNotify", 
+	"ConfigureRequest", "GravityNotify", "ResizeRequest", 
+	"CirculateNotify", "CirculateRequest", "PropertyNotify", 
+	"SelectionClear", "SelectionRequest", "SelectionNotify", 
+	"ColormapNotify", "ClientMessage", "MappingNotify", "GenericEvent"
+};
+
+uint64_t perf_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_sample(int hist, uint64_t value)
+{
+	struct histogram *h = &hists[hist];
+	uint64_t units = value / hist_info[hist].scale;
+	int b = 0;
+
+	while (b < PERF_BUCKETS - 1 && units >= (1ULL << b))
+		b++;
+	h->buckets[b]++;
+	h->count++;
+	h->total += value;
+	if (value > h->max)
+		h->max = value;
+}
+
+void perf_record(int hist, uint64_t since)
+{
+	add_sample(hist, perf_now() - since);
+}
+
+void perf_record_value(int hist, uint64_t value)
+{
+	add_sample(hist, value);
+}
+
+void perf_frame(uint events, int drawn)
+{
+	if (!drawn) {
+		PERF_ADD(PERF_EVENTS_DROPPED, events);
+		return;
+	}
+	PERF_COUNT(PERF_FRAMES);
+	PERF_ADD(PERF_EVENTS_FOLDED, events);
+	perf_record_value(PERF_HIST_FRAME_EVENTS, events);
+}
+
+void perf_input_arrived()
+{
+	if (!input_since)
+		input_since = perf_now();
+}
+
+void perf_input_presented()
+{
+	if (input_since)
+		perf_record(PERF_HIST_INPUT, input_since);
+	input_since = 0;
+}
+
+void perf_input_dropped()
+{
+	input_since = 0;
+}
+
+/* bucket upper bound where the p-th fraction of samples is reached */
+static uint64_t percentile(struct histogram *h, double p)
+{
+	uint64_t want = (uint64_t)(h->count * p);
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < PERF_BUCKETS; ++i) {
+		seen += h->buckets[i];
+		if (seen > want)
+			return 1ULL << i;
+	}
+	return 1ULL << (PERF_BUCKETS - 1);
+}
+
+void perf_dump()
+{
+	int i;
+
+	LOG_MESSAGE("---------- performance counters ----------");
+	for (i = 0; i < PERF_COUNTERS; ++i)
+		LOG_MESSAGE("%-18s %llu", counter_names[i], 
+				(unsigned long long)perf_counters[i]);
+
+	for (i = 0; i < PERF_EVENT_TYPES; ++i) {
+		if (!perf_events[i])
+			continue;
+		if (i < (int)ARRAY_LENGTH(event_names) && event_names[i])
+			LOG_MESSAGE("%-18s %llu", event_names[i], 
+					(unsigned long long)perf_events[i]);
+		else
+			LOG_MESSAGE("event %-12d %llu", i, 
+					(unsigned long long)perf_events[i]);
+	}
+	if (perf_events[PERF_EVENT_OTHER])
+		LOG_MESSAGE("%-18s %llu", "extension/other", 
+				(unsigned long long)perf_events[PERF_EVENT_OTHER]);
+
+	/* percentiles are bucket bounds, i.e. "below N us" */
+	for (i = 0; i < PERF_HISTS; ++i) {
+		struct histogram *h = &hists[i];
+		const char *u = hist_info[i].unit;
+		if (!h->count)
+			continue;
+		LOG_MESSAGE("%-18s n=%llu avg=%llu%s p50<%llu%s p99<%llu%s max=%llu%s",
+				hist_info[i].name,
+				(unsigned long long)h->count,
+				(unsigned long long)(h->total / h->count / hist_info[i].scale), u,
+				(unsigned long long)percentile(h, 0.5), u,
+				(unsigned long long)percentile(h, 0.99), u,
+				(unsigned long long)(h->max / hist_info[i].scale), u);
+	}
+}
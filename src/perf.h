@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_PERF_H
+#define BMPANEL_PERF_H
+
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Always-on performance counters and histograms, dumped to the log with 
+ * perf_dump() (on SIGUSR1 and at exit). A counter is an increment, a latency 
+ * sample is one clock_gettime (vDSO, no syscall) plus an increment, so it's 
+ * cheap enough to leave enabled.
+ *
+ * Everything is main thread only, except PERF_PROP_FETCHES which the icon 
+ * loader thread bumps as well (PERF_COUNT_MT).
+ */
+
+enum {
+	PERF_PROP_FETCHES,	/* xprop requests */
+	PERF_LAYOUTS,		/* layout_arrange calls */
+	PERF_RENDERS_FULL,	/* render_panel */
+	PERF_RENDERS_PARTIAL,	/* presents of a part of the panel */
+	PERF_PRESENT_BYTES,	/* ARGB bytes of presented spans */
+	PERF_ICON_DECODES,	/* icons turned into images (cache misses) */
+	PERF_FRAMES,		/* frames drawn because of X events */
+	PERF_EVENTS_FOLDED,	/* X events handled by those frames */
+	PERF_EVENTS_DROPPED,	/* X events which didn't cause any redraw */
+	PERF_COUNTERS
+};
+
+enum {
+	PERF_HIST_INPUT,	/* X event arrival -> present */
+	PERF_HIST_TASKBAR,	/* render_taskbar, render_taskbar_dirty */
+	PERF_HIST_SWITCHER,	/* render_switcher */
+	PERF_HIST_CLOCK,	/* render_clock */
+	PERF_HIST_PRESENT,	/* render_present */
+	PERF_HIST_FRAME_EVENTS,	/* X events per frame (a count, not a time) */
+	PERF_HISTS
+};
+
+/* 
+ * Core X event types are < 64 (LASTEvent is 36), extension events (e.g. 
+ * ShmCompletion) start at 64 and all go into one extra slot. 
+ */
+#define PERF_EVENT_TYPES 64
+#define PERF_EVENT_OTHER PERF_EVENT_TYPES
+
+extern uint64_t perf_counters[PERF_COUNTERS];
+extern uint64_t perf_events[PERF_EVENT_TYPES + 1];
+
+#define PERF_COUNT(c) (perf_counters[(c)]++)
+#define PERF_ADD(c, n) (perf_counters[(c)] += (n))
+#define PERF_COUNT_MT(c) __sync_fetch_and_add(&perf_counters[(c)], 1)
+#define PERF_COUNT_EVENT(type) \
+	(perf_events[(uint)(type) < PERF_EVENT_TYPES ? (type) : PERF_EVENT_OTHER]++)
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t perf_now();
+
+/* adds 'perf_now() - since' to the histogram */
+void perf_record(int hist, uint64_t since);
+
+/* adds a plain value to the histogram */
+void perf_record_value(int hist, uint64_t value);
+
+/* 
+ * A frame folded 'events' X events. Frames which redrew nothing pass 
+ * drawn = 0, their events are counted as dropped. 
+ */
+void perf_frame(uint events, int drawn);
+
+/* 
+ * Input latency: perf_input_arrived() remembers the time of the first event 
+ * nobody has seen on screen yet, render_present() closes the sample with 
+ * perf_input_presented(). Frames that present nothing call 
+ * perf_input_dropped(), so they don't count towards the next one.
+ */
+void perf_input_arrived();
+void perf_input_presented();
+void perf_input_dropped();
+
+void perf_dump();
+
+#endif
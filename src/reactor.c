@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "logger.h"
+#include "reactor.h"
+
+/* linux 3.0, glibc headers may not have it yet */
+#ifndef TFD_TIMER_CANCEL_ON_SET
+ #define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+#endif
+
+#define MAX_EVENTS 16
+#define MAX_DEFERRED 16
+
+struct reactor_watch {
+	struct reactor_watch *next;
+	int fd;
+	int timer;	/* fd is our timerfd */
+	int dead;	/* removed during dispatch, freed after it */
+	reactor_fd_cb fd_cb;
+	reactor_timer_cb timer_cb;
+	void *arg;
+};
+
+struct deferred_cb {
+	reactor_cb cb;
+	void *arg;
+};
+
+static struct deferred_cb deferred[MAX_DEFERRED];
+static int deferred_num;
+
+static int epfd = -1;
+static int quit;
+static struct reactor_watch *watches;
+static struct reactor_watch *graveyard;
+
+/**************************************************************************
+  watches
+**************************************************************************/
+
+static struct reactor_watch *add_watch(int fd, uint events)
+{
+	struct epoll_event ev;
+	struct reactor_watch *w = XMALLOCZ(struct reactor_watch, 1);
+
+	memset(&ev, 0, sizeof(ev));
+	if (events & REACTOR_READ)
+		ev.events |= EPOLLIN;
+	if (events & REACTOR_WRITE)
+		ev.events |= EPOLLOUT;
+	ev.data.ptr = w;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		LOG_WARNING("failed to add fd %d to epoll set: %s", fd, strerror(errno));
+		xfree(w);
+		return 0;
+	}
+
+	w->fd = fd;
+	w->next = watches;
+	watches = w;
+	return w;
+}
+
+static void free_watch(struct reactor_watch *w)
+{
+	if (w->timer)
+		close(w->fd);
+	xfree(w);
+}
+
+static void free_graveyard()
+{
+	struct reactor_watch *w;
+
+	while (graveyard) {
+		w = graveyard;
+		graveyard = w->next;
+		free_watch(w);
+	}
+}
+
+struct reactor_watch *reactor_add_fd(int fd, uint events, reactor_fd_cb cb, void *arg)
+{
+	struct reactor_watch *w = add_watch(fd, events);
+	if (!w)
+		return 0;
+	w->fd_cb = cb;
+	w->arg = arg;
+	return w;
+}
+
+struct reactor_watch *reactor_add_timer(clockid_t clock, reactor_timer_cb cb, void *arg)
+{
+	int fd = timerfd_create(clock, 0);
+	if (fd == -1) {
+		LOG_WARNING("failed to create timer fd: %s", strerror(errno));
+		return 0;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	struct reactor_watch *w = add_watch(fd, REACTOR_READ);
+	if (!w) {
+		close(fd);
+		return 0;
+	}
+	w->timer = 1;
+	w->timer_cb = cb;
+	w->arg = arg;
+	return w;
+}
+
+int reactor_set_timer(struct reactor_watch *w, uint flags, const struct itimerspec *its)
+{
+	int tfdflags = 0;
+
+	if (flags & REACTOR_TIMER_ABS)
+		tfdflags |= TFD_TIMER_ABSTIME;
+	if (flags & REACTOR_TIMER_CANCEL_ON_SET)
+		tfdflags |= TFD_TIMER_CANCEL_ON_SET;
+
+	if (timerfd_settime(w->fd, tfdflags, its, 0) == 0)
+		return 0;
+
+	/* older kernels don't know about cancel on set, live without it */
+	if (errno == EINVAL && (tfdflags & TFD_TIMER_CANCEL_ON_SET))
+		return timerfd_settime(w->fd, tfdflags & ~TFD_TIMER_CANCEL_ON_SET, its, 0);
+	return -1;
+}
+
+void reactor_remove(struct reactor_watch *w)
+{
+	struct reactor_watch **iter = &watches;
+
+	while (*iter && *iter != w)
+		iter = &(*iter)->next;
+	if (!*iter)
+		return;
+	*iter = w->next;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, 0);
+
+	/* dispatch may still have it in the current batch */
+	w->dead = 1;
+	w->next = graveyard;
+	graveyard = w;
+}
+
+/**************************************************************************
+  dispatch
+**************************************************************************/
+
+static void dispatch(struct reactor_watch *w, uint32_t events)
+{
+	if (w->timer) {
+		uint64_t expirations = 0;
+		if (read(w->fd, &expirations, sizeof(expirations)) == -1) {
+			if (errno != ECANCELED)
+				return;
+			expirations = 0;
+		}
+		w->timer_cb(expirations, w->arg);
+		return;
+	}
+
+	uint revents = 0;
+	/* hangups and errors are reported as readable, read() tells the rest */
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		revents |= REACTOR_READ;
+	if (events & EPOLLOUT)
+		revents |= REACTOR_WRITE;
+	w->fd_cb(w->fd, revents, w->arg);
+}
+
+static void run_deferred()
+{
+	struct deferred_cb batch[MAX_DEFERRED];
+	int i, n;
+
+	/* 
+	 * Callbacks may defer more, those run in this round too. The queue is 
+	 * emptied before running, so deferring a callback that already ran in 
+	 * this round queues it again instead of being taken for a duplicate. 
+	 */
+	while (deferred_num) {
+		n = deferred_num;
+		memcpy(batch, deferred, sizeof(struct deferred_cb) * n);
+		deferred_num = 0;
+		for (i = 0; i < n; ++i)
+			(*batch[i].cb)(batch[i].arg);
+	}
+}
+
+void reactor_defer(reactor_cb cb, void *arg)
+{
+	int i;
+
+	for (i = 0; i < deferred_num; ++i) {
+		if (deferred[i].cb == cb && deferred[i].arg == arg)
+			return;
+	}
+	if (deferred_num == MAX_DEFERRED) {
+		LOG_WARNING("too many deferred callbacks, running one in place");
+		(*cb)(arg);
+		return;
+	}
+	deferred[deferred_num].cb = cb;
+	deferred[deferred_num].arg = arg;
+	deferred_num++;
+}
+
+void reactor_run()
+{
+	struct epoll_event events[MAX_EVENTS];
+	int i, n;
+
+	quit = 0;
+	while (1) {
+		run_deferred();
+		free_graveyard();
+		if (quit)
+			break;
+
+		n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			LOG_WARNING("epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < n; ++i) {
+			struct reactor_watch *w = events[i].data.ptr;
+			if (!w->dead)
+				dispatch(w, events[i].events);
+		}
+	}
+}
+
+void reactor_quit()
+{
+	quit = 1;
+}
+
+/**************************************************************************
+  init/shutdown
+**************************************************************************/
+
+int reactor_init()
+{
+	epfd = epoll_create(MAX_EVENTS);
+	if (epfd == -1)
+		return -1;
+	fcntl(epfd, F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
+void reactor_shutdown()
+{
+	struct reactor_watch *w;
+
+	while (watches) {
+		w = watches;
+		watches = w->next;
+		free_watch(w);
+	}
+	free_graveyard();
+	deferred_num = 0;
+
+	if (epfd != -1)
+		close(epfd);
+	epfd = -1;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_REACTOR_H
+#define BMPANEL_REACTOR_H
+
+#include <stdint.h>
+#include <time.h>
+#include "common.h"
+
+/*
+ * Event loop. Everything the panel waits on sits in one epoll set: file 
+ * descriptors (X connection, worker thread eventfds, signalfd, ...) and 
+ * timers, each of them a timerfd. Adding a source is one epoll_ctl call, 
+ * nothing is rebuilt per iteration.
+ *
+ * Deferred callbacks (reactor_defer) run once after all ready sources of a 
+ * wakeup were dispatched, before the loop goes back to sleep. The panel draws 
+ * its frame there, so whatever happened during one wakeup costs one frame.
+ *
+ * Watches may be removed from any callback, including their own.
+ */
+
+#define REACTOR_READ	(1 << 0)
+#define REACTOR_WRITE	(1 << 1)
+
+/* reactor_set_timer flags */
+#define REACTOR_TIMER_ABS		(1 << 0) /* it_value is absolute */
+#define REACTOR_TIMER_CANCEL_ON_SET	(1 << 1) /* see below */
+
+struct reactor_watch;
+
+typedef void (*reactor_fd_cb)(int fd, uint events, void *arg);
+
+/* 
+ * 'expirations' is 0 if an absolute CLOCK_REALTIME timer armed with 
+ * REACTOR_TIMER_CANCEL_ON_SET was cancelled because the clock was set. 
+ * The timer is disarmed then.
+ */
+typedef void (*reactor_timer_cb)(uint64_t expirations, void *arg);
+
+typedef void (*reactor_cb)(void *arg);
+
+/* returns -1 on failure */
+int reactor_init();
+void reactor_shutdown();
+
+/* the fd is not owned by the reactor, it's not closed on removal */
+struct reactor_watch *reactor_add_fd(int fd, uint events, reactor_fd_cb cb, void *arg);
+
+/* timers are created disarmed */
+struct reactor_watch *reactor_add_timer(clockid_t clock, reactor_timer_cb cb, void *arg);
+int reactor_set_timer(struct reactor_watch *w, uint flags, const struct itimerspec *its);
+
+void reactor_remove(struct reactor_watch *w);
+
+/* the same cb/arg pair queued twice before it runs runs once */
+void reactor_defer(reactor_cb cb, void *arg);
+
+/* runs until reactor_quit() is called */
+void reactor_run();
+void reactor_quit();
+
+#endif
@@ -8,6 +8,13 @@
 #include <time.h>
 #include "logger.h"
 #include "render.h"
+#include "shm.h"
+#include "xrender.h"
+#include "textcache.h"
+#include "layout.h"
+#include "tasklist.h"
+#include "perf.h"
+#include "trace.h"
 
 /**************************************************************************
   GLOBALS
@@ -26,6 +33,8 @@ static Pixmap *rootpmap;
 static Pixmap currootpmap;
 
 static Imlib_Image bbcolor;
+static int use_shm;
+static int use_xrender;
 
 /* composite */
 #ifdef WITH_COMPOSITE
@@ -44,15 +53,105 @@ static Colormap bbcm;
 
 static struct theme *theme;
 
-/* temp vars for fast redraws */
-static int switcher_pos = 0;
-static int switcher_width = 0;
-static int clock_pos = 0;
-static int clock_width = 0;
-static int taskbar_pos = 0;
-static int taskbar_width = 0;
-static int tray_pos = 0;
-static int tray_width = 0;
+/* element positions, see layout.h */
+static struct layout lay;
+
+/* 
+ * Damaged parts of the backbuffer, as horizontal spans (panel is a strip, 
+ * every element takes the whole height). Only these are presented.
+ */
+#define MAX_DAMAGE_SPANS 8
+
+struct span {
+	int x;
+	int w;
+};
+
+static struct span damage[MAX_DAMAGE_SPANS];
+static int damage_count = 0;
+
+/* 
+ * Pre-composed left/tile/right backgrounds. All taskbar buttons on a desktop
+ * have the same width, so most of redraws become a single blit.
+ */
+#define BGCACHE_SIZE 16
+
+enum {
+	BG_TASKBAR,
+	BG_CLOCK,
+	BG_SWITCHER_ALONE,
+	BG_SWITCHER_LEFT,
+	BG_SWITCHER_MIDDLE,
+	BG_SWITCHER_RIGHT
+};
+
+struct bgcache_entry {
+	Imlib_Image img;
+	int element;
+	uint state;
+	int width;
+	uint used;
+};
+
+static struct bgcache_entry bgcache[BGCACHE_SIZE];
+static uint bgcache_clock;
+
+/* taskbar layout state, partial redraws are possible only if it's unchanged */
+static int taskbar_layout_changed = 1;
+static int taskbar_desktop = -1;
+static int taskbar_count = -1;
+static int taskbar_taskw = -1;
+
+/**************************************************************************
+  damage tracking
+**************************************************************************/
+
+static void add_damage(int x, int w)
+{
+	int i;
+
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (x + w > (int)bbwidth)
+		w = bbwidth - x;
+	if (w <= 0)
+		return;
+
+	/* merge with every span it touches, each merge can touch more */
+	for (i = 0; i < damage_count; ++i) {
+		struct span *d = &damage[i];
+		if (x <= d->x + d->w && d->x <= x + w) {
+			int r = (x + w > d->x + d->w) ? x + w : d->x + d->w;
+			x = (x < d->x) ? x : d->x;
+			w = r - x;
+			damage[i] = damage[--damage_count];
+			i = -1;
+		}
+	}
+
+	/* too fragmented, give up and damage the bounding span */
+	if (damage_count == MAX_DAMAGE_SPANS) {
+		for (i = 0; i < damage_count; ++i) {
+			int r = (x + w > damage[i].x + damage[i].w) ? 
+				x + w : damage[i].x + damage[i].w;
+			x = (x < damage[i].x) ? x : damage[i].x;
+			w = r - x;
+		}
+		damage_count = 0;
+	}
+
+	damage[damage_count].x = x;
+	damage[damage_count].w = w;
+	damage_count++;
+}
+
+static void damage_all()
+{
+	damage_count = 0;
+	add_damage(0, bbwidth);
+}
 
 /**************************************************************************
   misc helpers
@@ -66,21 +165,22 @@ static int get_image_width(Imlib_Image img)
 	return imlib_image_get_width();
 }
 
-static void draw_image(Imlib_Image img, int ox)
+/* client-side drawing onto an explicit destination image */
+static void draw_image_onto(Imlib_Image dst, Imlib_Image img, int ox)
 {
 	if (!img)
 		return;
 	int curw = get_image_width(img);
-	imlib_context_set_image(bb);
+	imlib_context_set_image(dst);
 	imlib_blend_image_onto_image(img, 1,
 			0, 0, curw, theme->height,
 			ox, 0, curw, theme->height);
 }
 
-static void tile_image(Imlib_Image img, int ox, int width)
+static void tile_image_onto(Imlib_Image dst, Imlib_Image img, int ox, int width)
 {
 	int curw = get_image_width(img);
-	imlib_context_set_image(bb);
+	imlib_context_set_image(dst);
 
 	while (width > 0) {
 		width -= curw;
@@ -94,6 +194,26 @@ static void tile_image(Imlib_Image img, int ox, int width)
 	}
 }
 
+static void draw_image(Imlib_Image img, int ox)
+{
+	if (!img)
+		return;
+	if (use_xrender) {
+		xr_draw_image(img, 0, 0, ox, 0, get_image_width(img), theme->height, 0);
+		return;
+	}
+	draw_image_onto(bb, img, ox);
+}
+
+static void tile_image(Imlib_Image img, int ox, int width)
+{
+	if (use_xrender) {
+		xr_tile_image(img, ox, 0, width, theme->height);
+		return;
+	}
+	tile_image_onto(bb, img, ox, width);
+}
+
 static void draw_tile_sequence(Imlib_Image left, Imlib_Image tile, Imlib_Image right,
 		int ox, int width)
 {
@@ -110,9 +230,97 @@ static void draw_tile_sequence(Imlib_Image left, Imlib_Image tile, Imlib_Image r
 	draw_image(right, ox);
 }
 
+/**************************************************************************
+  background cache
+**************************************************************************/
+
+static void free_bgcache_entry(struct bgcache_entry *e)
+{
+	if (!e->img)
+		return;
+	if (use_xrender)
+		xr_forget_image(e->img);
+	imlib_context_set_image(e->img);
+	imlib_free_image();
+	e->img = 0;
+}
+
+static void clear_bgcache()
+{
+	int i;
+	for (i = 0; i < BGCACHE_SIZE; ++i)
+		free_bgcache_entry(&bgcache[i]);
+}
+
+static void clear_bgcache_element(int element)
+{
+	int i;
+	for (i = 0; i < BGCACHE_SIZE; ++i) {
+		if (bgcache[i].element == element)
+			free_bgcache_entry(&bgcache[i]);
+	}
+}
+
+static Imlib_Image compose_tile_sequence(Imlib_Image left, Imlib_Image tile, 
+		Imlib_Image right, int width)
+{
+	Imlib_Image img;
+	int lw = get_image_width(left);
+	int tilew = width - lw - get_image_width(right);
+
+	img = imlib_create_image(width, theme->height);
+	if (!img)
+		return 0;
+	imlib_context_set_image(img);
+	imlib_image_set_has_alpha(1);
+	imlib_image_clear();
+
+	/* same as draw_tile_sequence, but onto our image and always client-side */
+	draw_image_onto(img, left, 0);
+	tile_image_onto(img, tile, lw, tilew);
+	draw_image_onto(img, right, lw + tilew);
+	return img;
+}
+
+static void draw_cached_sequence(int element, uint state, Imlib_Image left, 
+		Imlib_Image tile, Imlib_Image right, int ox, int width)
+{
+	struct bgcache_entry *e, *victim = &bgcache[0];
+	int i;
+
+	if (width - get_image_width(left) - get_image_width(right) < 0)
+		return;
+
+	for (i = 0; i < BGCACHE_SIZE; ++i) {
+		e = &bgcache[i];
+		if (e->img && e->element == element && 
+		    e->state == state && e->width == width) 
+		{
+			e->used = ++bgcache_clock;
+			draw_image(e->img, ox);
+			return;
+		}
+		if (!e->img || (victim->img && e->used < victim->used))
+			victim = e;
+	}
+
+	free_bgcache_entry(victim);
+	victim->img = compose_tile_sequence(left, tile, right, width);
+	if (!victim->img) {
+		draw_tile_sequence(left, tile, right, ox, width);
+		return;
+	}
+	victim->element = element;
+	victim->state = state;
+	victim->width = width;
+	victim->used = ++bgcache_clock;
+	draw_image(victim->img, ox);
+}
+
 static void draw_switcher_alone(uint state, int ox, int width)
 {
-	draw_tile_sequence(theme->switcher.left_corner_img[state],
+	draw_cached_sequence(BG_SWITCHER_ALONE, state,
+			   theme->switcher.left_corner_img[state],
 			   theme->switcher.tile_img[state],
 			   theme->switcher.right_corner_img[state],
 			   ox, width);
@@ -120,7 +328,8 @@ static void draw_switcher_alone(uint state, int ox, int width)
 
 static void draw_switcher_left_corner(uint state, int ox, int width)
 {
-	draw_tile_sequence(theme->switcher.left_corner_img[state],
+	draw_cached_sequence(BG_SWITCHER_LEFT, state,
+			   theme->switcher.left_corner_img[state],
 			   theme->switcher.tile_img[state],
 			   theme->switcher.right_img[state],
 			   ox, width);
@@ -128,7 +337,8 @@ static void draw_switcher_left_corner(uint state, int ox, int width)
 
 static void draw_switcher_middle(uint state, int ox, int width)
 {
-	draw_tile_sequence(theme->switcher.left_img[state],
+	draw_cached_sequence(BG_SWITCHER_MIDDLE, state,
+			   theme->switcher.left_img[state],
 			   theme->switcher.tile_img[state],
 			   theme->switcher.right_img[state],
 			   ox, width);
@@ -136,7 +346,8 @@ static void draw_switcher_middle(uint state, int ox, int width)
 
 static void draw_switcher_right_corner(uint state, int ox, int width)
 {
-	draw_tile_sequence(theme->switcher.left_img[state],
+	draw_cached_sequence(BG_SWITCHER_RIGHT, state,
+			   theme->switcher.left_img[state],
 			   theme->switcher.tile_img[state],
 			   theme->switcher.right_corner_img[state],
 			   ox, width);
@@ -146,7 +357,8 @@ static void draw_taskbar_button(uint state, int ox, int width)
 {
 	ox += theme->taskbar.space_gap;
 	width -= theme->taskbar.space_gap * 2;
-	draw_tile_sequence(theme->taskbar.left_img[state],
+	draw_cached_sequence(BG_TASKBAR, state,
+			   theme->taskbar.left_img[state],
 			   theme->taskbar.tile_img[state],
 			   theme->taskbar.right_img[state],
 			   ox, width);
@@ -157,7 +369,7 @@ static void draw_clock_background(int ox, int width)
 {
 	ox += theme->clock.space_gap;
 	width -= theme->clock.space_gap * 2;
-	draw_tile_sequence(theme->clock.left_img,
+	draw_cached_sequence(BG_CLOCK, 0, theme->clock.left_img,
 			   theme->clock.tile_img,
 			   theme->clock.right_img,
 			   ox, width);
@@ -176,17 +388,41 @@ static void get_text_dimensions(Imlib_Font font, const char *text, int *w, int *
 	imlib_get_text_size(text, w, h);
 }
 
+static int get_desktop_text_width(struct desktop *d)
+{
+	if (d->textw < 0)
+		get_text_dimensions(theme->switcher.font, d->name, &d->textw, 0);
+	return d->textw;
+}
+
+static int clip_x, clip_y, clip_w, clip_h;
+
+static void set_clip(int x, int y, int w, int h)
+{
+	clip_x = x; clip_y = y;
+	clip_w = w; clip_h = h;
+	imlib_context_set_cliprect(x, y, w, h);
+	if (use_xrender)
+		xr_set_clip(x, y, w, h);
+}
+
 static void draw_text(Imlib_Font font, uint align, int ox, int width, 
 		int offx, int offy, const char *text, struct color *c)
 {
 	if (!font)
 		return;
 
-	imlib_context_set_image(bb);
-	imlib_context_set_font(font);
-	imlib_context_set_color(c->r, c->g, c->b, 255);
+	/* 
+	 * Text comes rasterized from the cache. Left aligned text is visible 
+	 * only up to the clip width, so there is no need to keep more of it.
+	 */
 	int texth, textw, oy;
-	imlib_get_text_size(text, &textw, &texth);
+	int crop = (align == ALIGN_LEFT && offx >= 0);
+	Imlib_Image img = textcache_get(font, text, c, width, crop, &textw, &texth);
+	imlib_context_set_cliprect(clip_x, clip_y, clip_w, clip_h);
+	if (!img)
+		return;
+
 	oy = (theme->height - texth) / 2;
 	switch (align) {
 	case ALIGN_LEFT:
@@ -201,8 +437,17 @@ static void draw_text(Imlib_Font font, uint align, int ox, int width,
 
 	ox += offx;
 	oy += offy;
-	
-	imlib_text_draw(ox, oy, text);
+
+	int imgw = get_image_width(img);
+	if (use_xrender) {
+		xr_draw_image(img, 0, 0, ox, oy, imgw, texth, 1);
+		return;
+	}
+
+	imlib_context_set_image(bb);
+	imlib_context_set_blend(1);
+	imlib_blend_image_onto_image(img, 1, 0, 0, imgw, texth, ox, oy, imgw, texth);
+	imlib_context_set_blend(0);
 }
 
 /**************************************************************************
@@ -218,26 +463,23 @@ static int get_tray_width(struct tray *trayicons)
 		iter = iter->next;
 	}
 
-	tray_width = count * theme->tray_icon_w;
-	if (tray_width) {
-		tray_width += theme->tray_space_gap * 2 + 
+	int w = count * theme->tray_icon_w;
+	if (w) {
+		w += theme->tray_space_gap * 2 + 
 			(count - 1) * theme->tray_icons_spacing;
 	}
-	return tray_width;
+	return w;
 }
 
-static int update_tray_positions(int ox, struct tray *trayicons)
+static void update_tray_positions(int ox, struct tray *trayicons)
 {
-	tray_pos = ox;
 	ox += theme->tray_space_gap;
-	int count = 0;
 	int y,w,h;
 	int th = theme->height_override ? theme->height_override : theme->height;
 	w = theme->tray_icon_w;
 	h = theme->tray_icon_h;
 	struct tray *iter = trayicons;
 	while (iter) {
-		count++;
 		y = (th - h) / 2;
 		if (theme->height_override)
 			y += theme->height - theme->height_override;
@@ -252,45 +494,38 @@ static int update_tray_positions(int ox, struct tray *trayicons)
 		ox += w + theme->tray_icons_spacing;
 		iter = iter->next;
 	}
-
-	tray_width = count * theme->tray_icon_w;
-	if (tray_width) {
-		tray_width += theme->tray_space_gap * 2 + 
-			(count - 1) * theme->tray_icons_spacing;
-	}
-	return tray_width;
 }
 
 /**************************************************************************
   clock functions
 **************************************************************************/
 
-static int update_clock_positions(int ox)
+/* 
+ * Clock width is measured on a fixed time (epoch), so it never changes while 
+ * the theme is loaded. Computed once.
+ */
+static int clock_textw = -1;
+
+static int get_clock_width()
 {
-	clock_pos = ox;
 	int w = 0;
 	w += theme->clock.space_gap * 2;
 	w += get_image_width(theme->clock.left_img);
 	w += get_image_width(theme->clock.right_img);
 	
-	char buftime[128];
-	time_t current_time;
-	memset(&current_time, 0, sizeof(time_t));
-	strftime(buftime, sizeof(buftime), theme->clock.format, localtime(&current_time));
-
-	int fontw;
-	get_text_dimensions(theme->clock.font, buftime, &fontw, 0);
-	w += fontw + theme->clock.text_padding;
-	clock_width = w;
+	if (clock_textw < 0) {
+		char buftime[128];
+		time_t current_time;
+		memset(&current_time, 0, sizeof(time_t));
+		strftime(buftime, sizeof(buftime), theme->clock.format, 
+				localtime(&current_time));
+		get_text_dimensions(theme->clock.font, buftime, &clock_textw, 0);
+	}
+	w += clock_textw + theme->clock.text_padding;
 	return w;
 }
 
-static int get_clock_width()
-{
-	return update_clock_positions(0);
-}
-
-int render_clock()
+static int draw_clock()
 {
 	static char buflasttime[128];
 	char buftime[128];
@@ -301,23 +536,33 @@ int render_clock()
 		return 0;
 	strcpy(buflasttime, buftime);
 	
-	tile_image(theme->tile_img, clock_pos, clock_width);
-	int ox = clock_pos;
-	draw_clock_background(ox, clock_width);
+	tile_image(theme->tile_img, lay.clock.x, lay.clock.w);
+	add_damage(lay.clock.x, lay.clock.w);
+	int ox = lay.clock.x;
+	draw_clock_background(ox, lay.clock.w);
 	int gap = theme->clock.space_gap;
 	int lgap = get_image_width(theme->clock.left_img);
 	int rgap = get_image_width(theme->clock.right_img);
 	int x = ox + gap + lgap;
-	int w = clock_width - ((gap * 2) + lgap + rgap);
+	int w = lay.clock.w - ((gap * 2) + lgap + rgap);
 
-	imlib_context_set_cliprect(x, 0, w, bbheight);
+	set_clip(x, 0, w, bbheight);
 	draw_text(theme->clock.font, theme->clock.text_align, x, w,
 			theme->clock.text_offset_x, theme->clock.text_offset_y,
 			buftime, &theme->clock.text_color);
-	imlib_context_set_cliprect(0, 0, bbwidth, bbheight);
+	set_clip(0, 0, bbwidth, bbheight);
 	return 1;
 }
 
+int render_clock()
+{
+	TRACE_SCOPE("render_clock");
+	uint64_t t0 = perf_now();
+	int ret = draw_clock();
+	perf_record(PERF_HIST_CLOCK, t0);
+	return ret;
+}
+
 /**************************************************************************
   desktop switcher functions
 **************************************************************************/
@@ -325,8 +570,6 @@ int render_clock()
 static int update_switcher_positions(int ox, struct desktop *desktops)
 {
 	struct desktop *iter, *prev;
-	switcher_pos = ox;
-	switcher_width = 0;
 
 	if (!desktops)
 		return 0;
@@ -337,14 +580,14 @@ static int update_switcher_positions(int ox, struct desktop *desktops)
 	w += theme->switcher.space_gap;
 	ox += w; lastw = w;
 	w += get_image_width(theme->switcher.left_corner_img[state]);
-	get_text_dimensions(theme->switcher.font, iter->name, &textw, 0);
+	textw = get_desktop_text_width(iter);
 	w += textw + theme->switcher.text_padding;
 
 	while (iter->next) {
 		prev = iter;
 		iter = iter->next;
 		state = iter->focused ? BSTATE_PRESSED : BSTATE_IDLE;
-		get_text_dimensions(theme->switcher.font, iter->name, &textw, 0);
+		textw = get_desktop_text_width(iter);
 		w += get_image_width(theme->switcher.right_img[state]);
 		prev->posx = ox;
 		prev->width = w - lastw;
@@ -357,8 +600,6 @@ static int update_switcher_positions(int ox, struct desktop *desktops)
 	iter->posx = ox;
 	iter->width = w - lastw;
 	w += theme->switcher.space_gap;
-
-	switcher_width = w;
 	return w;
 }
 
@@ -367,12 +608,13 @@ static int get_switcher_width(struct desktop *desktops)
 	return update_switcher_positions(0, desktops);
 }
 
-void render_switcher(struct desktop *desktops)
+static void draw_switcher(struct desktop *desktops)
 {		
-	tile_image(theme->tile_img, switcher_pos, switcher_width);
+	tile_image(theme->tile_img, lay.switcher.x, lay.switcher.w);
+	add_damage(lay.switcher.x, lay.switcher.w);
 	if (!desktops)
 		return;
-	int ox = switcher_pos;
+	int ox = lay.switcher.x;
 	int limgw, rimgw;
 	ox += theme->switcher.space_gap;
 	uint state;
@@ -423,16 +665,20 @@ void render_switcher(struct desktop *desktops)
 			iter->name, &theme->switcher.text_color[state]);
 }
 
+void render_switcher(struct desktop *desktops)
+{
+	TRACE_SCOPE("render_switcher");
+	uint64_t t0 = perf_now();
+	draw_switcher(desktops);
+	perf_record(PERF_HIST_SWITCHER, t0);
+}
+
 /**************************************************************************
   taskbar functions
 **************************************************************************/
 
-static int update_taskbar_positions(int ox, int width, 
-		struct task *tasks, struct desktop *desktops)
+static int get_active_desktop_index(struct desktop *desktops)
 {
-	taskbar_pos = ox;
-	taskbar_width = width;
-
 	int activedesktop = 0;
 	struct desktop *iter = desktops;
 	while (iter) {
@@ -441,105 +687,161 @@ static int update_taskbar_positions(int ox, int width,
 		activedesktop++;
 		iter = iter->next;
 	}
+	return activedesktop;
+}
 
-	int taskscount = 0;
-	struct task *t = tasks;
-	while (t) {
-		if (t->desktop == activedesktop || t->desktop == -1)
-			taskscount++;
-		t = t->next;
-	}
-	if (!taskscount)
-		return width;
-
-	int taskw = width / taskscount;
+static void update_taskbar_positions(struct tasklist *tasks, struct desktop *desktops)
+{
+	int activedesktop = get_active_desktop_index(desktops);
 	int sep = get_image_width(theme->taskbar.separator_img);
-	if (sep)
-		taskw -= sep;
-
-	t = tasks;
-	while (t) {
-		if (t->desktop == -1) {
-			t->posx = ox;
-			t->width = taskw;
-			ox += taskw;
-			if (t->next)
-				ox += sep;
-		}
-		if (t->desktop == activedesktop) {
-			t->posx = ox;
-			t->width = taskw;
-			ox += taskw;
-			if (t->next)
-				ox += sep;
-			/* hack, fill empty space in the end of the task bar */
-			if (!t->next || t->next->desktop != activedesktop)
-				t->width += taskbar_pos + width - ox;
+	int taskscount = tasklist_visible(tasks, activedesktop);
+	int changed = 0, n = 0;
+	uint i, j;
+
+	/* sticky tasks go first */
+	struct task_bucket *buckets[2] = {
+		&tasks->sticky, 
+		tasklist_bucket(tasks, activedesktop)
+	};
+	struct layout_row row;
+	layout_row_init(&row, taskscount, lay.taskbar.x, lay.taskbar.w, sep);
+
+	for (i = 0; i < 2; ++i) {
+		for (j = 0; j < buckets[i]->count; ++j) {
+			struct task *t = buckets[i]->tasks[j];
+			struct layout_box b = {t->posx, t->width};
+			changed |= layout_row_place(&row, n++, &b);
+			t->posx = b.x;
+			t->width = b.w;
 		}
-		t = t->next;
 	}
+	int taskw = taskscount ? row.buttonw : taskbar_taskw;
 
-	return width;
+	if (changed || activedesktop != taskbar_desktop || taskscount != taskbar_count)
+		taskbar_layout_changed = 1;
+	taskbar_desktop = activedesktop;
+	taskbar_count = taskscount;
+
+	/* button size changed, cached backgrounds are useless now */
+	if (taskw != taskbar_taskw) {
+		clear_bgcache_element(BG_TASKBAR);
+		taskbar_taskw = taskw;
+	}
 }
 
-void render_taskbar(struct task *tasks, struct desktop *desktops)
+static void draw_task(struct task *t)
 {
-	tile_image(theme->tile_img, taskbar_pos, taskbar_width);
-	int activedesktop = 0;
-	struct desktop *iter = desktops;
-	while (iter) {
-		if (iter->focused)
-			break;
-		activedesktop++;
-		iter = iter->next;
-	}
-	
-	struct task *t = tasks;
-	uint state;
+	uint state = t->focused ? BSTATE_PRESSED : BSTATE_IDLE;
 	int gap = theme->taskbar.space_gap;
 
-	while (t) {
-		if (t->desktop == activedesktop || t->desktop == -1) {
-			state = t->focused ? BSTATE_PRESSED : BSTATE_IDLE;
-			/* draw bg */
-			draw_taskbar_button(state, t->posx, t->width);
-			int lgap = get_image_width(theme->taskbar.left_img[state]);
-			int rgap = get_image_width(theme->taskbar.right_img[state]);
-			int x = t->posx + gap + lgap;
-			int w = t->width - ((gap * 2) + lgap + rgap);
-
-			/* draw icon */
-			if (theme->taskbar.icon_h && theme->taskbar.icon_w) {
-				int srcw, srch;
-				int y = (theme->height - theme->taskbar.icon_h) / 2;
-				imlib_context_set_image(t->icon);
-				srcw = imlib_image_get_width();
-				srch = imlib_image_get_height();
-				y += theme->taskbar.icon_offset_y;
-				x += theme->taskbar.icon_offset_x;
-				w -= theme->taskbar.icon_offset_x;
-				imlib_context_set_image(bb);
-				imlib_context_set_blend(1);
-				imlib_blend_image_onto_image(t->icon, 1, 0, 0, srcw, srch,
-						x, y, theme->taskbar.icon_w, theme->taskbar.icon_h);
-				imlib_context_set_blend(0);
-				x += theme->taskbar.icon_w;
-				w -= theme->taskbar.icon_w;
-			}
+	/* draw bg */
+	draw_taskbar_button(state, t->posx, t->width);
+	int lgap = get_image_width(theme->taskbar.left_img[state]);
+	int rgap = get_image_width(theme->taskbar.right_img[state]);
+	int x = t->posx + gap + lgap;
+	int w = t->width - ((gap * 2) + lgap + rgap);
+
+	/* draw icon */
+	if (theme->taskbar.icon_h && theme->taskbar.icon_w) {
+		int srcw, srch;
+		int y = (theme->height - theme->taskbar.icon_h) / 2;
+		imlib_context_set_image(t->icon);
+		srcw = imlib_image_get_width();
+		srch = imlib_image_get_height();
+		y += theme->taskbar.icon_offset_y;
+		x += theme->taskbar.icon_offset_x;
+		w -= theme->taskbar.icon_offset_x;
+		if (use_xrender) {
+			/* icons are already scaled to the theme size */
+			xr_draw_image(t->icon, 0, 0, x, y, 
+					theme->taskbar.icon_w, theme->taskbar.icon_h, 1);
+		} else {
+			imlib_context_set_image(bb);
+			imlib_context_set_blend(1);
+			imlib_blend_image_onto_image(t->icon, 1, 0, 0, srcw, srch,
+					x, y, theme->taskbar.icon_w, theme->taskbar.icon_h);
+			imlib_context_set_blend(0);
+		}
+		x += theme->taskbar.icon_w;
+		w -= theme->taskbar.icon_w;
+	}
+
+	/* draw text */
+	set_clip(x, 0, w, bbheight);
+	draw_text(theme->taskbar.font, theme->taskbar.text_align, x, w,
+		theme->taskbar.text_offset_x, theme->taskbar.text_offset_y,
+		t->name, &theme->taskbar.text_color[state]);
+	set_clip(0, 0, bbwidth, bbheight);
 
-			/* draw text */
-			imlib_context_set_cliprect(x, 0, w, bbheight);
-			draw_text(theme->taskbar.font, theme->taskbar.text_align, x, w,
-				theme->taskbar.text_offset_x, theme->taskbar.text_offset_y,
-				t->name, &theme->taskbar.text_color[state]);
-			imlib_context_set_cliprect(0, 0, bbwidth, bbheight);
+	t->dirty = 0;
+}
+
+static void draw_taskbar(struct tasklist *tasks, struct desktop *desktops)
+{
+	tile_image(theme->tile_img, lay.taskbar.x, lay.taskbar.w);
+	add_damage(lay.taskbar.x, lay.taskbar.w);
+	int activedesktop = get_active_desktop_index(desktops);
+	
+	/* sticky tasks go first */
+	struct task_bucket *buckets[2] = {
+		&tasks->sticky, 
+		tasklist_bucket(tasks, activedesktop)
+	};
+	uint left = tasklist_visible(tasks, activedesktop);
+	uint i, j;
+
+	for (i = 0; i < 2; ++i) {
+		for (j = 0; j < buckets[i]->count; ++j) {
+			struct task *t = buckets[i]->tasks[j];
+			draw_task(t);
 
 			/* draw separator if exists */
-			if (t->next && t->next->desktop == activedesktop)
-				draw_image(theme->taskbar.separator_img, x+w+gap+rgap);
+			if (--left)
+				draw_image(theme->taskbar.separator_img, t->posx + t->width);
+		}
+	}
+	taskbar_layout_changed = 0;
+}
+
+void render_taskbar(struct tasklist *tasks, struct desktop *desktops)
+{
+	TRACE_SCOPE("render_taskbar");
+	uint64_t t0 = perf_now();
+	draw_taskbar(tasks, desktops);
+	perf_record(PERF_HIST_TASKBAR, t0);
+}
+
+int render_taskbar_dirty(struct tasklist *tasks, struct desktop *desktops)
+{
+	TRACE_SCOPE("render_taskbar_dirty");
+	/* buttons moved, there is no way to repaint them one by one */
+	if (taskbar_layout_changed) {
+		render_taskbar(tasks, desktops);
+		return 1;
+	}
+
+	uint64_t t0 = perf_now();
+	int activedesktop = get_active_desktop_index(desktops);
+	struct task_bucket *buckets[2] = {
+		&tasks->sticky, 
+		tasklist_bucket(tasks, activedesktop)
+	};
+	int count = 0;
+	uint i, j;
+
+	for (i = 0; i < 2; ++i) {
+		for (j = 0; j < buckets[i]->count; ++j) {
+			struct task *t = buckets[i]->tasks[j];
+			if (!t->dirty)
+				continue;
+			tile_image(theme->tile_img, t->posx, t->width);
+			add_damage(t->posx, t->width);
+			draw_task(t);
+			count++;
 		}
-		t = t->next;
 	}
+	perf_record(PERF_HIST_TASKBAR, t0);
+	return count;
 }
 
 /**************************************************************************
@@ -568,6 +870,8 @@ static void tile_image_blend(Imlib_Image dst, Imlib_Image img, int ox, int width
 
 static void update_bg()
 {
+	if (!bbdpy)
+		return;
 	if (currootpmap != *rootpmap && *rootpmap != 0) {
 		currootpmap = *rootpmap;
 		imlib_context_set_drawable(currootpmap);
@@ -576,6 +880,7 @@ static void update_bg()
 			imlib_free_image();
 		}
 		bg = imlib_create_image_from_drawable(0, bbx, bby, bbwidth, bbheight, 1);
+		damage_all();
 
 		Pixmap tile, mask;
 		imlib_context_set_display(bbdpy);
@@ -610,7 +915,6 @@ void init_render(struct xinfo *X, struct panel *P)
 	bbwidth = P->width;
 	bbheight = P->theme->height;
 	bb = imlib_create_image(bbwidth, bbheight);
-	bbcolor = imlib_create_image(bbwidth, bbheight);
 	imlib_context_set_image(bb);
 	imlib_image_set_has_alpha(1);
 	bbdpy = X->display;
@@ -621,11 +925,32 @@ void init_render(struct xinfo *X, struct panel *P)
 	bby = P->y;
 	rootpmap = &X->rootpmap;
 	theme = P->theme;
+	layout_init(&lay, theme->elements, bbwidth, 
+			get_image_width(theme->separator_img));
 
 	imlib_context_set_display(bbdpy);
 	imlib_context_set_visual(bbvis);
 	imlib_context_set_colormap(bbcm);
 
+	/* 
+	 * No display means offscreen rendering for a replay (see replay.h): 
+	 * no server side tricks, no background, frames end in bbcolor. 
+	 */
+
+	/* presented image may live in shared memory, see shm.h */
+	use_shm = bbdpy && !P->theme->use_composite && 
+		shm_init(bbdpy, bbvis, X->depth, bbwin, bbwidth, bbheight);
+	if (use_shm)
+		bbcolor = imlib_create_image_using_data(bbwidth, bbheight, shm_get_data());
+	else
+		bbcolor = imlib_create_image(bbwidth, bbheight);
+
+	/* no shm (e.g. remote X), compose on the server side if we can */
+	use_xrender = bbdpy && !use_shm && !P->theme->use_composite &&
+		xr_init(bbdpy, bbvis, X->depth, bbwin, bbwidth, bbheight);
+	textcache_init(use_xrender ? xr_forget_image : 0);
+	set_clip(0, 0, bbwidth, bbheight);
+
 #ifdef WITH_COMPOSITE
 	if (P->theme->use_composite) {
 		XRenderPictFormat *fmt = XRenderFindStandardFormat(bbdpy, PictStandardARGB32);
@@ -643,7 +968,9 @@ void init_render(struct xinfo *X, struct panel *P)
 				CPSubwindowMode, &pwin);
 	} else 
 #endif
-	if (*rootpmap) {
+	if (!bbdpy) {
+		/* offscreen */
+	} else if (*rootpmap) {
 		update_bg();
 	} else {
 		set_bg();
@@ -659,6 +986,14 @@ void shutdown_render()
 	imlib_free_image();
 	imlib_context_set_image(bbcolor);
 	imlib_free_image();
+	if (use_shm)
+		shm_shutdown();
+	clear_bgcache();
+	textcache_shutdown();
+	clock_textw = -1;
+	if (use_xrender)
+		xr_shutdown();
+	use_shm = use_xrender = 0;
 
 #ifdef WITH_COMPOSITE
 	if (theme->use_composite) {
@@ -678,89 +1013,53 @@ void shutdown_render()
 	}
 }
 
-void render_update_panel_positions(struct panel *p)
+void render_update_panel_positions(struct panel *p, uint what)
 {
-	char *e = theme->elements;
-	int ox = 0;
-	int taskbarx = 0;
-	/* figure out taskbar position and width */
-	while (*e) {
-		switch (*e) {
-		/* clock */
-		case 'c':
-			ox += get_clock_width();
-			break;
-		/* desktop switcher */
-		case 's':
-			ox += get_switcher_width(p->desktops);
-			break;
-		/* tray */
-		case 't':
-			if (!p->trayicons) {
-				/* we're skipping if no tray icons here, separator is being drawn only once */
-				e++;
-				continue;
-			}
-			ox += get_tray_width(p->trayicons);
-			break;
-		/* taskbar */
-		case 'b': 
-			taskbarx = ox;
-			e++;
-			continue;
-		}
-		if (theme->separator_img)
-			ox += get_image_width(theme->separator_img);
-		e++;
-	}
-	int taskbarw = bbwidth - ox;
+	TRACE_SCOPE("layout");
+	if (what & LAYOUT_CLOCK)
+		lay.clock.w = get_clock_width();
+	if (what & LAYOUT_SWITCHER)
+		lay.switcher.w = get_switcher_width(p->desktops);
+	if (what & LAYOUT_TRAY)
+		lay.tray.w = get_tray_width(p->trayicons);
+
+	/* a resized element moves its neighbours */
+	uint moved = layout_arrange(&lay);
+	PERF_COUNT(PERF_LAYOUTS);
+	if (moved & LAYOUT_TASKBAR)
+		taskbar_layout_changed = 1;
+	what |= moved;
+
+	if (what & LAYOUT_SWITCHER)
+		update_switcher_positions(lay.switcher.x, p->desktops);
+	if ((what & LAYOUT_TRAY) && lay.tray.w)
+		update_tray_positions(lay.tray.x, p->trayicons);
+	if (what & LAYOUT_TASKBAR)
+		update_taskbar_positions(&p->tasks, p->desktops);
+}
 
-	/* now really update all positions */
-	ox = 0;
-	e = theme->elements;
-	while (*e) {
-		switch (*e) {
-		/* clock */
-		case 'c':
-			ox += update_clock_positions(ox);
-			break;
-		/* desktop switcher */
-		case 's':
-			ox += update_switcher_positions(ox, p->desktops);
-			break;
-		/* tray */
-		case 't':
-			if (!p->trayicons) {
-				/* we're skipping if no tray icons here, separator is being drawn only once */
-				e++;
-				continue;
-			}
-			ox += update_tray_positions(ox, p->trayicons);
-			break;
-		/* taskbar */
-		case 'b': 
-			ox += update_taskbar_positions(taskbarx, taskbarw, p->tasks, p->desktops);
-			break;
-		}
-		if (*++e && theme->separator_img) {
-			ox += get_image_width(theme->separator_img);
-		}
-	}
+void render_forget_image(Imlib_Image img)
+{
+	if (use_xrender)
+		xr_forget_image(img);
 }
 
+static int full_render;
+
 void render_panel(struct panel *p)
 {
+	TRACE_SCOPE("render_panel");
 	int ox = 0;
 	char *e = theme->elements;
 	while (*e) {
 		switch (*e) {
 		case 'c':
 			render_clock();
-			ox += clock_width;
+			ox += lay.clock.w;
 			break;
 		case 's':
 			render_switcher(p->desktops);
-			ox += switcher_width;
+			ox += lay.switcher.w;
 			break;
 		case 't':
 			if (!p->trayicons) {
@@ -768,13 +1067,13 @@ void render_panel(struct panel *p)
 				e++;
 				continue;
 			}
-			if (tray_width)
-				tile_image(theme->tile_img, tray_pos, tray_width);
-			ox += tray_width;
+			if (lay.tray.w)
+				tile_image(theme->tile_img, lay.tray.x, lay.tray.w);
+			ox += lay.tray.w;
 			break;
 		case 'b':
-			render_taskbar(p->tasks, p->desktops);
-			ox += taskbar_width;
+			render_taskbar(&p->tasks, p->desktops);
+			ox += lay.taskbar.w;
 			break;
 		}
 		if (*++e && theme->separator_img) {
@@ -782,12 +1081,21 @@ void render_panel(struct panel *p)
 			ox += get_image_width(theme->separator_img);
 		}
 	}
+	damage_all();
+	full_render = 1;
 	render_present();
+	full_render = 0;
 }
 
-void render_present()
+static void present_span(int x, int w)
 {
-	update_bg();
+	/* offscreen, do the CPU part of the usual path only */
+	if (!bbdpy) {
+		imlib_context_set_image(bbcolor);
+		imlib_blend_image_onto_image(bb,0,x,0,w,bbheight,x,0,w,bbheight);
+		return;
+	}
+
 #ifdef WITH_COMPOSITE
 	if (theme->use_composite) {
 		/* 
@@ -804,39 +1112,72 @@ void render_present()
 		imlib_context_set_image(bbcolor);
 		imlib_image_set_has_alpha(1);
 		imlib_context_set_color(0,0,0,255);
-		imlib_image_fill_rectangle(0,0,bbwidth,bbheight);
-		imlib_blend_image_onto_image(bb,0,0,0,bbwidth,bbheight,0,0,bbwidth,bbheight);
+		imlib_image_fill_rectangle(x,0,w,bbheight);
+		imlib_blend_image_onto_image(bb,0,x,0,w,bbheight,x,0,w,bbheight);
 		imlib_context_set_drawable(pixcolor);
-		imlib_render_image_on_drawable(0,0);
+		imlib_render_image_part_on_drawable_at_size(x,0,w,bbheight,x,0,w,bbheight);
 
 		/* copy alpha part to bbalpha */
 		imlib_context_set_image(bbalpha);
-		imlib_image_copy_alpha_to_image(bb,0,0);
+		imlib_image_copy_alpha_rectangle_to_image(bb,x,0,w,bbheight,x,0);
 		imlib_image_set_has_alpha(1);
 		imlib_context_set_drawable(pixalpha);
-		imlib_render_image_on_drawable(0,0);
+		imlib_render_image_part_on_drawable_at_size(x,0,w,bbheight,x,0,w,bbheight);
 
 		XRenderComposite(bbdpy,
 				 PictOpSrc,
 				 piccolor,
 				 picalpha,
 				 rootpic,
-				 0, 0, 0, 0, 0, 0, bbwidth, 
+				 x, 0, x, 0, x, 0, w, 
 				 bbheight);
 	} else 
 #endif
-	if (*rootpmap) {
+	if (use_xrender) {
+		xr_present(*rootpmap, bbx, bby, x, w);
+	} else if (use_shm) {
+		/* bbcolor is the shared image, compose there and let server read it */
+		imlib_context_set_image(bbcolor);
+		if (*rootpmap) {
+			imlib_blend_image_onto_image(bg,0,x,0,w,bbheight,x,0,w,bbheight);
+			imlib_context_set_blend(1);
+			imlib_blend_image_onto_image(bb,0,x,0,w,bbheight,x,0,w,bbheight);
+			imlib_context_set_blend(0);
+		} else 
+			imlib_blend_image_onto_image(bb,0,x,0,w,bbheight,x,0,w,bbheight);
+		shm_put(x,0,w,bbheight);
+	} else if (*rootpmap) {
 		imlib_context_set_image(bbcolor);
-		imlib_blend_image_onto_image(bg,0,0,0,bbwidth,bbheight,0,0,bbwidth,bbheight);
+		imlib_blend_image_onto_image(bg,0,x,0,w,bbheight,x,0,w,bbheight);
 		imlib_context_set_blend(1);
-		imlib_blend_image_onto_image(bb,0,0,0,bbwidth,bbheight,0,0,bbwidth,bbheight);
+		imlib_blend_image_onto_image(bb,0,x,0,w,bbheight,x,0,w,bbheight);
 		imlib_context_set_blend(0);
 
 		imlib_context_set_drawable(bbwin);
-		imlib_render_image_on_drawable(0,0);	
+		imlib_render_image_part_on_drawable_at_size(x,0,w,bbheight,x,0,w,bbheight);
 	} else {
 		imlib_context_set_drawable(bbwin);
 		imlib_context_set_image(bb);
-		imlib_render_image_on_drawable(0,0);
+		imlib_render_image_part_on_drawable_at_size(x,0,w,bbheight,x,0,w,bbheight);
+	}
+}
+
+void render_present()
+{
+	TRACE_SCOPE("render_present");
+	uint64_t t0 = perf_now();
+	int i;
+
+	update_bg();
+	if (use_shm && damage_count)
+		shm_wait();
+	for (i = 0; i < damage_count; ++i) {
+		present_span(damage[i].x, damage[i].w);
+		PERF_ADD(PERF_PRESENT_BYTES, damage[i].w * bbheight * 4);
 	}
+	damage_count = 0;
+
+	PERF_COUNT(full_render ? PERF_RENDERS_FULL : PERF_RENDERS_PARTIAL);
+	perf_record(PERF_HIST_PRESENT, t0);
+	perf_input_presented();
 }
@@ -10,15 +10,18 @@
 #include "common.h"
 #include "bmpanel.h"
 #include "theme.h"
+#include "layout.h"
 
 void init_render(struct xinfo *X, struct panel *P);
 void shutdown_render();
 
-void render_update_panel_positions(struct panel *p);
+void render_update_panel_positions(struct panel *p, uint what);
 void render_switcher(struct desktop *d);
-void render_taskbar(struct task *t, struct desktop *d);
+void render_taskbar(struct tasklist *tl, struct desktop *d);
+int render_taskbar_dirty(struct tasklist *tl, struct desktop *d);
 int render_clock();
 void render_panel(struct panel *p);
 void render_present();
+void render_forget_image(Imlib_Image img);
 
 #endif
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "logger.h"
+#include "replay.h"
+
+#define REPLAY_MAGIC "BMPR"
+#define REPLAY_VERSION 2
+
+#define RECORD_PROP 'P'
+#define RECORD_EVENT 'E'
+#define RECORD_FRAME 'F'
+
+#define STORE_BUCKETS 1024
+
+static FILE *recfile;
+static FILE *playfile;
+static int nextkind = EOF;
+
+/**************************************************************************
+  file helpers
+**************************************************************************/
+
+static void put_u32(uint32_t v)
+{
+	fwrite(&v, sizeof(v), 1, recfile);
+}
+
+static int get_u32(uint32_t *v)
+{
+	return fread(v, sizeof(*v), 1, playfile) == 1;
+}
+
+/**************************************************************************
+  recording
+**************************************************************************/
+
+int replay_record_start(const char *path, struct xinfo *X)
+{
+	int i;
+
+	recfile = fopen(path, "wb");
+	if (!recfile)
+		return -1;
+
+	fwrite(REPLAY_MAGIC, 4, 1, recfile);
+	put_u32(REPLAY_VERSION);
+	put_u32(X->screen_width);
+	put_u32(X->screen_height);
+	put_u32(X->root);
+	put_u32(XATOM_COUNT);
+	for (i = 0; i < XATOM_COUNT; ++i)
+		put_u32(X->atoms[i]);
+
+	LOG_MESSAGE("recording X events to %s", path);
+	return 0;
+}
+
+void replay_record_stop()
+{
+	if (recfile)
+		fclose(recfile);
+	recfile = 0;
+}
+
+int replay_recording()
+{
+	return recfile != 0;
+}
+
+void replay_record_event(XEvent *e)
+{
+	uint32_t atom = (e->type == PropertyNotify) ? e->xproperty.atom : 0;
+
+	fputc(RECORD_EVENT, recfile);
+	fputc(e->type, recfile);
+	put_u32(e->xany.window);
+	put_u32(atom);
+}
+
+void replay_record_frame()
+{
+	fputc(RECORD_FRAME, recfile);
+}
+
+void replay_record_prop(Window win, Atom prop, Atom type, uint32_t offset, 
+		xcb_get_property_reply_t *r)
+{
+	uint32_t nbytes = r ? r->value_len * (r->format / 8) : 0;
+
+	fputc(RECORD_PROP, recfile);
+	put_u32(win);
+	put_u32(prop);
+	put_u32(type);
+	put_u32(offset);
+	/* no reply at all (BadWindow) is stored as an empty property */
+	put_u32(r ? r->type : XCB_NONE);
+	put_u32(r ? r->bytes_after : 0);
+	put_u32(r ? r->value_len : 0);
+	fputc(r ? r->format : 0, recfile);
+	if (nbytes)
+		fwrite(xcb_get_property_value(r), nbytes, 1, recfile);
+}
+
+/**************************************************************************
+  property store
+**************************************************************************/
+
+struct prop_entry {
+	struct prop_entry *next;
+
+	/* request */
+	Window win;
+	Atom prop;
+	Atom type;
+	uint32_t offset;
+
+	/* reply */
+	Atom rtype;
+	uint32_t bytes_after;
+	uint32_t value_len;
+	uint format;
+	uchar *data;
+};
+
+static struct prop_entry *store[STORE_BUCKETS];
+
+static uint store_hash(Window win, Atom prop, uint32_t offset)
+{
+	return (uint)(win * 31 + prop * 7 + offset) & (STORE_BUCKETS - 1);
+}
+
+static struct prop_entry *store_find(Window win, Atom prop, Atom type, uint32_t offset)
+{
+	struct prop_entry *e = store[store_hash(win, prop, offset)];
+	while (e) {
+		if (e->win == win && e->prop == prop && e->type == type && 
+		    e->offset == offset)
+			return e;
+		e = e->next;
+	}
+	return 0;
+}
+
+static void store_free()
+{
+	struct prop_entry *e, *next;
+	int i;
+
+	for (i = 0; i < STORE_BUCKETS; ++i) {
+		for (e = store[i]; e; e = next) {
+			next = e->next;
+			if (e->data)
+				xfree(e->data);
+			xfree(e);
+		}
+		store[i] = 0;
+	}
+}
+
+/* reads a 'P' record, the kind byte is already consumed */
+static int read_prop()
+{
+	uint32_t win, prop, type, offset, rtype, bytes_after, value_len;
+	int format;
+
+	if (!get_u32(&win) || !get_u32(&prop) || !get_u32(&type) || 
+	    !get_u32(&offset) || !get_u32(&rtype) || !get_u32(&bytes_after) ||
+	    !get_u32(&value_len) || (format = fgetc(playfile)) == EOF)
+		return 0;
+
+	struct prop_entry *e = store_find(win, prop, type, offset);
+	if (!e) {
+		uint h = store_hash(win, prop, offset);
+		e = XMALLOCZ(struct prop_entry, 1);
+		e->win = win;
+		e->prop = prop;
+		e->type = type;
+		e->offset = offset;
+		e->next = store[h];
+		store[h] = e;
+	}
+	if (e->data)
+		xfree(e->data);
+	e->data = 0;
+
+	e->rtype = rtype;
+	e->bytes_after = bytes_after;
+	e->value_len = value_len;
+	e->format = format;
+
+	uint32_t nbytes = value_len * (format / 8);
+	if (nbytes) {
+		e->data = xmalloc(nbytes);
+		if (fread(e->data, nbytes, 1, playfile) != 1)
+			return 0;
+	}
+	return 1;
+}
+
+xcb_get_property_reply_t *replay_lookup(Window win, Atom prop, Atom type, 
+		uint32_t offset, uint32_t length)
+{
+	struct prop_entry *e = store_find(win, prop, type, offset);
+	if (!e)
+		return 0;
+
+	/* serve the requested range of what was recorded */
+	uint unit = e->format / 8;
+	uint32_t nbytes = e->value_len * unit;
+	uint32_t served = nbytes;
+	if (length < 0x7fffffff / 4 && served > length * 4)
+		served = length * 4;
+
+	xcb_get_property_reply_t *r = calloc(1, sizeof(*r) + served);
+	if (!r)
+		LOG_ERROR("replay: out of memory");
+	r->response_type = XCB_GET_PROPERTY;
+	r->format = e->format;
+	r->type = e->rtype;
+	r->bytes_after = e->bytes_after + (nbytes - served);
+	r->value_len = unit ? served / unit : 0;
+	if (served)
+		memcpy(xcb_get_property_value(r), e->data, served);
+	return r;
+}
+
+/**************************************************************************
+  replaying
+**************************************************************************/
+
+/* 
+ * Reads records until the next event, frame mark (or the end), properties 
+ * go to the store. 
+ */
+static void absorb_props()
+{
+	while ((nextkind = fgetc(playfile)) == RECORD_PROP) {
+		if (!read_prop()) {
+			LOG_WARNING("replay: truncated property record");
+			nextkind = EOF;
+			return;
+		}
+	}
+	if (nextkind != EOF && nextkind != RECORD_EVENT && nextkind != RECORD_FRAME) {
+		LOG_WARNING("replay: unknown record '%c', stopping", nextkind);
+		nextkind = EOF;
+	}
+}
+
+int replay_open(const char *path, struct xinfo *X)
+{
+	char magic[4];
+	uint32_t version, w, h, root, natoms, atom;
+	int i;
+
+	playfile = fopen(path, "rb");
+	if (!playfile)
+		return -1;
+
+	if (fread(magic, 4, 1, playfile) != 1 || memcmp(magic, REPLAY_MAGIC, 4) ||
+	    !get_u32(&version) || version != REPLAY_VERSION || 
+	    !get_u32(&w) || !get_u32(&h) || !get_u32(&root) || !get_u32(&natoms))
+	{
+		LOG_WARNING("replay: %s is not a bmpanel recording", path);
+		replay_close();
+		return -1;
+	}
+
+	/* atom indices are baked into the code, the table must match */
+	if (natoms != XATOM_COUNT) {
+		LOG_WARNING("replay: %s was recorded by a build with %u atoms, we have %u",
+				path, natoms, XATOM_COUNT);
+		replay_close();
+		return -1;
+	}
+	for (i = 0; i < XATOM_COUNT; ++i) {
+		if (!get_u32(&atom)) {
+			replay_close();
+			return -1;
+		}
+		X->atoms[i] = atom;
+	}
+
+	X->screen_width = X->wa_w = w;
+	X->screen_height = X->wa_h = h;
+	X->root = root;
+
+	absorb_props();
+	LOG_MESSAGE("replaying X events from %s", path);
+	return 0;
+}
+
+void replay_close()
+{
+	if (playfile)
+		fclose(playfile);
+	playfile = 0;
+	nextkind = EOF;
+	store_free();
+}
+
+int replay_active()
+{
+	return playfile != 0;
+}
+
+/* 
+ * A run longer than 'max' is split, then the first part is handled before 
+ * the properties of the whole run are loaded. 
+ */
+int replay_next_batch(XEvent *events, int max, int *frame_end)
+{
+	uint32_t win, atom;
+	int type, n = 0;
+
+	*frame_end = 0;
+	while (nextkind == RECORD_EVENT && n < max) {
+		if ((type = fgetc(playfile)) == EOF || !get_u32(&win) || !get_u32(&atom)) {
+			LOG_WARNING("replay: truncated event record");
+			nextkind = EOF;
+			break;
+		}
+
+		XEvent *e = &events[n++];
+		memset(e, 0, sizeof(XEvent));
+		e->type = type;
+		e->xany.window = win;
+		if (type == PropertyNotify)
+			e->xproperty.atom = atom;
+
+		nextkind = fgetc(playfile);
+	}
+	if (nextkind == RECORD_EVENT)
+		return n;
+
+	/* properties fetched inline by the handlers of this run */
+	if (nextkind == RECORD_PROP) {
+		ungetc(nextkind, playfile);
+		absorb_props();
+	}
+
+	/* the frame mark and properties fetched by the frame */
+	if (nextkind == RECORD_FRAME) {
+		*frame_end = 1;
+		absorb_props();
+	} else if (nextkind == EOF) {
+		*frame_end = 1;
+	}
+	return n;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_REPLAY_H
+#define BMPANEL_REPLAY_H
+
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+#include "common.h"
+#include "bmpanel.h"
+
+/*
+ * Record and replay of X event workloads, for benchmarking.
+ *
+ * bmpanel --record FILE writes every X event the panel receives and every 
+ * property reply it gets (see xprop.h) to FILE. bmpanel --replay FILE runs 
+ * the panel without an X server: property requests are answered from a 
+ * store filled from the file, recorded events go through the real handlers 
+ * and frames are rendered offscreen. The replay ends with CPU time and 
+ * allocation counts in the log, two builds can be compared on exactly the 
+ * same workload.
+ *
+ * It replays property traffic, it doesn't emulate a server. Only events 
+ * whose handlers don't talk to X are replayed (PropertyNotify, FocusIn, 
+ * Expose), the others are skipped. There is no tray during replay.
+ *
+ * File format, native byte order:
+ *   header:  "BMPR", version, screen width/height, root window, 
+ *            XATOM_COUNT atoms as they were interned while recording
+ *   records: 'P' property reply, keyed by window/property/type/offset
+ *            'E' event: type, window, atom
+ *            'F' frame: frame_cb ran for the events since the previous 'F'
+ *
+ * 'P' records between 'E' records are what the handlers fetched inline, the 
+ * ones after an 'F' are what that frame fetched. Replay renders a frame at 
+ * every 'F', so it draws as many frames as the recorded session did.
+ */
+
+#define REPLAY_MAX_BATCH 1024
+
+/* recording, returns -1 if the file can't be created */
+int replay_record_start(const char *path, struct xinfo *X);
+void replay_record_stop();
+int replay_recording();
+void replay_record_event(XEvent *e);
+void replay_record_frame();
+void replay_record_prop(Window win, Atom prop, Atom type, uint32_t offset, 
+		xcb_get_property_reply_t *r);
+
+/* 
+ * Replaying. replay_open() fills screen size, root window and atoms of X 
+ * and loads the properties fetched before the first event. 
+ */
+int replay_open(const char *path, struct xinfo *X);
+void replay_close();
+int replay_active();
+
+/* a malloc'ed reply like the one XCB would return, 0 if nothing recorded */
+xcb_get_property_reply_t *replay_lookup(Window win, Atom prop, Atom type, 
+		uint32_t offset, uint32_t length);
+
+/* 
+ * Next batch of events, 0 at the end of the file. 'frame_end' is set if a 
+ * frame has to be rendered after the batch, otherwise the next batch 
+ * belongs to the same frame. 
+ */
+int replay_next_batch(XEvent *events, int max, int *frame_end);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include "logger.h"
+#include "shm.h"
+
+#if defined(WITH_SHM)
+
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+static Display *dpy;
+static Drawable drawable;
+static GC gc;
+static XImage *img;
+static XShmSegmentInfo shminfo;
+static int completion_type;
+static uint in_flight;
+static int attach_failed;
+
+/* bytes which would go through the socket without shm */
+static ulonglong bytes_saved;
+
+static int attach_error_handler(Display *d, XErrorEvent *e)
+{
+	attach_failed = 1;
+	return 0;
+}
+
+static int is_local_display(Display *d)
+{
+	const char *name = DisplayString(d);
+	return name && (name[0] == ':' || !strncmp(name, "unix:", 5));
+}
+
+static int image_matches_imlib(XImage *i)
+{
+	static const uint32_t one = 1;
+	int lsb = *(const uchar*)&one;
+
+	return i->bits_per_pixel == 32 &&
+	       i->red_mask == 0xff0000 &&
+	       i->green_mask == 0xff00 &&
+	       i->blue_mask == 0xff &&
+	       i->byte_order == (lsb ? LSBFirst : MSBFirst) &&
+	       i->bytes_per_line == i->width * 4;
+}
+
+static void free_segment()
+{
+	if (img) {
+		/* data is the shared segment, XDestroyImage must not free() it */
+		img->data = 0;
+		XDestroyImage(img);
+		img = 0;
+	}
+	if (shminfo.shmaddr && shminfo.shmaddr != (char*)-1)
+		shmdt(shminfo.shmaddr);
+	memset(&shminfo, 0, sizeof(shminfo));
+}
+
+int shm_init(Display *d, Visual *vis, int depth, Drawable win, int w, int h)
+{
+	int (*old_handler)(Display*, XErrorEvent*);
+
+	dpy = d;
+	drawable = win;
+
+	if (!is_local_display(dpy) || !XShmQueryExtension(dpy)) {
+		LOG_INFO("shm: not available, using regular image upload");
+		return 0;
+	}
+
+	img = XShmCreateImage(dpy, vis, depth, ZPixmap, 0, &shminfo, w, h);
+	if (!img)
+		return 0;
+	if (!image_matches_imlib(img)) {
+		LOG_INFO("shm: visual format doesn't match, using regular image upload");
+		free_segment();
+		return 0;
+	}
+
+	shminfo.shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT | 0600);
+	if (shminfo.shmid == -1) {
+		free_segment();
+		return 0;
+	}
+	shminfo.shmaddr = img->data = shmat(shminfo.shmid, 0, 0);
+	shminfo.readOnly = False;
+	if (shminfo.shmaddr == (char*)-1) {
+		shmctl(shminfo.shmid, IPC_RMID, 0);
+		free_segment();
+		return 0;
+	}
+
+	/* attach may fail even on a local server (e.g. different ipc namespace) */
+	attach_failed = 0;
+	old_handler = XSetErrorHandler(attach_error_handler);
+	XShmAttach(dpy, &shminfo);
+	XSync(dpy, False);
+	XSetErrorHandler(old_handler);
+
+	/* segment will be destroyed when both sides detach */
+	shmctl(shminfo.shmid, IPC_RMID, 0);
+
+	if (attach_failed) {
+		LOG_INFO("shm: attach failed, using regular image upload");
+		free_segment();
+		return 0;
+	}
+
+	gc = XCreateGC(dpy, drawable, 0, 0);
+	completion_type = XShmGetEventBase(dpy) + ShmCompletion;
+	in_flight = 0;
+	bytes_saved = 0;
+	LOG_INFO("shm: using shared memory image upload");
+	return 1;
+}
+
+void shm_shutdown()
+{
+	if (!img)
+		return;
+
+	shm_wait();
+	LOG_INFO("shm: %llu bytes presented without going through the socket",
+			bytes_saved);
+	XShmDetach(dpy, &shminfo);
+	XFreeGC(dpy, gc);
+	XSync(dpy, False);
+	free_segment();
+}
+
+uint32_t *shm_get_data()
+{
+	return img ? (uint32_t*)img->data : 0;
+}
+
+void shm_put(int x, int y, int w, int h)
+{
+	XShmPutImage(dpy, drawable, gc, img, x, y, x, y, w, h, True);
+	in_flight++;
+	bytes_saved += (ulonglong)w * h * 4;
+}
+
+static Bool is_completion(Display *d, XEvent *e, XPointer arg)
+{
+	return e->type == completion_type;
+}
+
+void shm_wait()
+{
+	XEvent e;
+
+	/* don't touch pixels the server is still reading */
+	while (in_flight) {
+		XIfEvent(dpy, &e, is_completion, 0);
+		in_flight--;
+	}
+}
+
+int shm_handle_event(XEvent *e)
+{
+	if (!img || e->type != completion_type)
+		return 0;
+	if (in_flight)
+		in_flight--;
+	return 1;
+}
+
+#else
+
+int shm_init(Display *dpy, Visual *vis, int depth, Drawable win, int w, int h)
+{
+	return 0;
+}
+
+void shm_shutdown()
+{
+}
+
+uint32_t *shm_get_data()
+{
+	return 0;
+}
+
+void shm_put(int x, int y, int w, int h)
+{
+}
+
+void shm_wait()
+{
+}
+
+int shm_handle_event(XEvent *e)
+{
+	return 0;
+}
+
+#endif
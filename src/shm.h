@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_SHM_H
+#define BMPANEL_SHM_H
+
+#include <X11/Xlib.h>
+#include "common.h"
+
+/*
+ * MIT-SHM presentation. The presented image lives in a shared memory XImage,
+ * Imlib draws right into it and the server reads it from there, pixels never
+ * go through the X socket. Works only with a local server and a 32 bpp 
+ * TrueColor visual that matches Imlib's ARGB layout, shm_init() returns 0 
+ * otherwise and the caller should fall back to the usual Imlib path.
+ *
+ * Compiled in with --with-shm, without it shm_init() always fails.
+ */
+
+int shm_init(Display *dpy, Visual *vis, int depth, Drawable win, int w, int h);
+void shm_shutdown();
+
+uint32_t *shm_get_data();
+void shm_put(int x, int y, int w, int h);
+void shm_wait();
+int shm_handle_event(XEvent *e);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <string.h>
+#include "tasklist.h"
+
+/* tasks on desktops past this one are not shown anywhere */
+#define MAX_DESKTOPS 256
+
+static struct task_bucket empty_bucket;
+
+static void free_bucket(struct task_bucket *b)
+{
+	if (b->tasks)
+		xfree(b->tasks);
+	memset(b, 0, sizeof(struct task_bucket));
+}
+
+static void grow_bucket(struct task_bucket *b)
+{
+	uint alloc = b->alloc ? b->alloc * 2 : 16;
+	struct task **tasks = XMALLOC(struct task*, alloc);
+	if (b->count)
+		memcpy(tasks, b->tasks, sizeof(struct task*) * b->count);
+	if (b->tasks)
+		xfree(b->tasks);
+	b->tasks = tasks;
+	b->alloc = alloc;
+}
+
+static struct task_bucket *get_bucket(struct tasklist *l, int desktop, int create)
+{
+	if (desktop == -1)
+		return &l->sticky;
+	if (desktop < 0 || desktop >= MAX_DESKTOPS)
+		return &l->nowhere;
+
+	if ((uint)desktop >= l->desktopsnum) {
+		if (!create)
+			return &empty_bucket;
+		uint num = desktop + 1;
+		struct task_bucket *desktops = XMALLOCZ(struct task_bucket, num);
+		if (l->desktopsnum)
+			memcpy(desktops, l->desktops, sizeof(struct task_bucket) * l->desktopsnum);
+		if (l->desktops)
+			xfree(l->desktops);
+		l->desktops = desktops;
+		l->desktopsnum = num;
+	}
+	return &l->desktops[desktop];
+}
+
+void tasklist_init(struct tasklist *l)
+{
+	memset(l, 0, sizeof(struct tasklist));
+}
+
+void tasklist_free(struct tasklist *l)
+{
+	uint i;
+	free_bucket(&l->sticky);
+	free_bucket(&l->nowhere);
+	for (i = 0; i < l->desktopsnum; ++i)
+		free_bucket(&l->desktops[i]);
+	if (l->desktops)
+		xfree(l->desktops);
+	memset(l, 0, sizeof(struct tasklist));
+}
+
+void tasklist_add(struct tasklist *l, struct task *t)
+{
+	struct task_bucket *b = get_bucket(l, t->desktop, 1);
+	if (b->count == b->alloc)
+		grow_bucket(b);
+	t->slot = b->count;
+	b->tasks[b->count++] = t;
+	l->count++;
+}
+
+void tasklist_remove(struct tasklist *l, struct task *t)
+{
+	struct task_bucket *b = get_bucket(l, t->desktop, 0);
+	uint i;
+
+	/* keep button order, shifting pointers is cheap */
+	b->count--;
+	for (i = t->slot; i < b->count; ++i) {
+		b->tasks[i] = b->tasks[i+1];
+		b->tasks[i]->slot = i;
+	}
+	l->count--;
+}
+
+void tasklist_move(struct tasklist *l, struct task *t, int desktop)
+{
+	tasklist_remove(l, t);
+	t->desktop = desktop;
+	tasklist_add(l, t);
+}
+
+struct task_bucket *tasklist_bucket(struct tasklist *l, int desktop)
+{
+	return get_bucket(l, desktop, 0);
+}
+
+uint tasklist_visible(struct tasklist *l, int desktop)
+{
+	if (desktop == -1)
+		return l->sticky.count;
+	return l->sticky.count + get_bucket(l, desktop, 0)->count;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_TASKLIST_H
+#define BMPANEL_TASKLIST_H
+
+#include "common.h"
+#include "bmpanel.h"
+
+/* 
+ * Tasks grouped by desktop. Each desktop has a contiguous array of task 
+ * pointers in button order, tasks on desktop -1 (sticky) have their own 
+ * bucket and are shown before the tasks of the active desktop. A task knows 
+ * its slot in the bucket, so it's removed without searching.
+ */
+
+void tasklist_init(struct tasklist *l);
+void tasklist_free(struct tasklist *l);
+
+/* appends 't' to the bucket of t->desktop */
+void tasklist_add(struct tasklist *l, struct task *t);
+void tasklist_remove(struct tasklist *l, struct task *t);
+void tasklist_move(struct tasklist *l, struct task *t, int desktop);
+
+/* never returns 0, desktops without tasks share an empty bucket */
+struct task_bucket *tasklist_bucket(struct tasklist *l, int desktop);
+
+/* number of buttons on 'desktop', including sticky ones */
+uint tasklist_visible(struct tasklist *l, int desktop);
+
+#endif
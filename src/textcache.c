@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <string.h>
+#include "logger.h"
+#include "textcache.h"
+
+#define TEXTCACHE_SIZE 256
+
+struct text_entry {
+	Imlib_Image img;
+	Imlib_Font font;
+	char *text;
+	uint32_t hash;
+	struct color color;
+	int clipw;
+	int crop;
+	int textw;
+	int texth;
+	uint used;
+};
+
+static struct text_entry entries[TEXTCACHE_SIZE];
+static uint tick;
+static uint hits;
+static uint misses;
+static void (*evict)(Imlib_Image);
+
+static uint32_t hash_string(const char *s)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261U;
+	while (*s) {
+		h ^= (uchar)*s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void free_entry(struct text_entry *e)
+{
+	if (e->img) {
+		if (evict)
+			evict(e->img);
+		imlib_context_set_image(e->img);
+		imlib_free_image();
+	}
+	if (e->text)
+		xfree(e->text);
+	memset(e, 0, sizeof(struct text_entry));
+}
+
+static Imlib_Image rasterize(Imlib_Font font, const char *text, struct color *c,
+		int w, int h)
+{
+	Imlib_Image img;
+
+	if (w <= 0 || h <= 0)
+		return 0;
+
+	img = imlib_create_image(w, h);
+	if (!img)
+		return 0;
+	imlib_context_set_image(img);
+	imlib_image_set_has_alpha(1);
+	imlib_image_clear();
+	imlib_context_set_cliprect(0, 0, w, h);
+	imlib_context_set_font(font);
+	imlib_context_set_color(c->r, c->g, c->b, 255);
+	imlib_text_draw(0, 0, text);
+	imlib_context_set_cliprect(0, 0, 0, 0);
+	return img;
+}
+
+void textcache_init(void (*evict_cb)(Imlib_Image))
+{
+	evict = evict_cb;
+	hits = misses = 0;
+}
+
+void textcache_shutdown()
+{
+	int i;
+
+	LOG_INFO("text cache: %u hits, %u misses", hits, misses);
+	for (i = 0; i < TEXTCACHE_SIZE; ++i)
+		free_entry(&entries[i]);
+	evict = 0;
+}
+
+Imlib_Image textcache_get(Imlib_Font font, const char *text, struct color *c,
+		int clipw, int crop, int *textw, int *texth)
+{
+	struct text_entry *e, *victim = &entries[0];
+	uint32_t hash = hash_string(text);
+	int i;
+
+	for (i = 0; i < TEXTCACHE_SIZE; ++i) {
+		e = &entries[i];
+		if (e->text && e->hash == hash && e->font == font && 
+		    e->clipw == clipw && e->crop == crop &&
+		    e->color.r == c->r && e->color.g == c->g && e->color.b == c->b &&
+		    !strcmp(e->text, text))
+		{
+			hits++;
+			e->used = ++tick;
+			*textw = e->textw;
+			*texth = e->texth;
+			return e->img;
+		}
+		if (!victim->text)
+			continue;
+		if (!e->text || e->used < victim->used)
+			victim = e;
+	}
+
+	misses++;
+	free_entry(victim);
+
+	imlib_context_set_font(font);
+	imlib_get_text_size(text, &victim->textw, &victim->texth);
+
+	victim->img = rasterize(font, text, c, 
+			(crop && victim->textw > clipw) ? clipw : victim->textw,
+			victim->texth);
+	victim->font = font;
+	victim->text = xstrdup(text);
+	victim->hash = hash;
+	victim->color = *c;
+	victim->clipw = clipw;
+	victim->crop = crop;
+	victim->used = ++tick;
+
+	*textw = victim->textw;
+	*texth = victim->texth;
+	return victim->img;
+}
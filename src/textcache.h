@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_TEXTCACHE_H
+#define BMPANEL_TEXTCACHE_H
+
+#include <Imlib2.h>
+#include "common.h"
+#include "theme.h"
+
+/*
+ * Bounded LRU cache of rasterized strings. Each entry is a transparent image
+ * with the text drawn at (0,0), keyed by (font, string, color, clip width).
+ * When 'crop' is set, the image is cut to the clip width, long window titles
+ * don't need to be kept whole if only their beginning is ever visible.
+ */
+
+void textcache_init(void (*evict_cb)(Imlib_Image));
+void textcache_shutdown();
+
+Imlib_Image textcache_get(Imlib_Font font, const char *text, struct color *c,
+		int clipw, int crop, int *textw, int *texth);
+
+#endif
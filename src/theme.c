@@ -21,6 +21,8 @@ static void parse_color(struct color *c, const char *value);
 static uchar hex_to_dec(uchar c);
 static int load_and_parse_theme(struct theme *t);
 
+static Imlib_Image expand_tile(Imlib_Image img, int width);
+
 static Imlib_Font load_font(const char *pattern);
 static int init_fontcfg();
 static void shutdown_fontcfg();
@@ -102,6 +104,21 @@ void free_theme(struct theme *t)
 	shutdown_fontcfg();
 }
 
+void theme_expand_tiles(struct theme *t, int width)
+{
+	/* 
+	 * Themes usually ship 1-2px wide tiles, filling a panel with them means 
+	 * hundreds of blends per redraw. Repeat each tile once here up to the 
+	 * whole panel width, so that any tile fill becomes a single blend.
+	 */
+	t->tile_img = expand_tile(t->tile_img, width);
+	t->clock.tile_img = expand_tile(t->clock.tile_img, width);
+	t->taskbar.tile_img[BSTATE_IDLE] = expand_tile(t->taskbar.tile_img[BSTATE_IDLE], width);
+	t->taskbar.tile_img[BSTATE_PRESSED] = expand_tile(t->taskbar.tile_img[BSTATE_PRESSED], width);
+	t->switcher.tile_img[BSTATE_IDLE] = expand_tile(t->switcher.tile_img[BSTATE_IDLE], width);
+	t->switcher.tile_img[BSTATE_PRESSED] = expand_tile(t->switcher.tile_img[BSTATE_PRESSED], width);
+}
+
 int theme_is_valid(struct theme *t)
 {
 	if (!t->elements) {
@@ -201,6 +218,48 @@ static void free_imlib_image(Imlib_Image img)
 	imlib_free_image();
 }
 
+/**************************************************************************
+  tile strips
+**************************************************************************/
+
+static Imlib_Image expand_tile(Imlib_Image img, int width)
+{
+	int w, h, stripw;
+	char alpha;
+	Imlib_Image strip;
+
+	if (!img)
+		return 0;
+
+	imlib_context_set_image(img);
+	w = imlib_image_get_width();
+	h = imlib_image_get_height();
+	alpha = imlib_image_has_alpha();
+	if (w <= 0 || w >= width)
+		return img;
+
+	/* round up to the tile width, so the pattern stays seamless */
+	stripw = ((width + w - 1) / w) * w;
+	strip = imlib_create_image(stripw, h);
+	if (!strip)
+		return img;
+
+	imlib_context_set_image(strip);
+	imlib_image_set_has_alpha(alpha);
+	imlib_context_set_blend(0);
+	imlib_blend_image_onto_image(img, 1, 0, 0, w, h, 0, 0, w, h);
+
+	/* double the filled part until the strip is full */
+	while (w < stripw) {
+		int cw = (w * 2 > stripw) ? stripw - w : w;
+		imlib_blend_image_onto_image(strip, 1, 0, 0, cw, h, w, 0, cw, h);
+		w += cw;
+	}
+
+	free_imlib_image(img);
+	return strip;
+}
+
 /**************************************************************************
   string to enum converters
 **************************************************************************/
@@ -125,6 +125,7 @@ struct theme {
 
 struct theme *load_theme(const char *dir);
 void free_theme(struct theme *t);
+void theme_expand_tiles(struct theme *t, int width);
 int theme_is_valid(struct theme *t);
 int is_element_in_theme(struct theme *t, char e);
 void theme_remove_element(struct theme* t, char e);
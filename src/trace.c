@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include "logger.h"
+#include "trace.h"
+
+#if defined(WITH_TRACE)
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "perf.h"
+
+struct trace_event {
+	const char *name;
+	uint64_t start;	/* ns, CLOCK_MONOTONIC */
+	uint64_t dur;
+	int tid;
+};
+
+static struct trace_event ring[TRACE_RING_SIZE];
+static uint64_t head; /* total number of recorded spans */
+static __thread int tid;
+
+struct trace_scope trace_scope_begin(const char *name)
+{
+	struct trace_scope s = {name, perf_now()};
+	return s;
+}
+
+void trace_scope_end(struct trace_scope *s)
+{
+	uint64_t now = perf_now();
+	uint64_t i = __sync_fetch_and_add(&head, 1);
+	struct trace_event *e = &ring[i & (TRACE_RING_SIZE - 1)];
+
+	if (!tid)
+		tid = syscall(SYS_gettid);
+	e->name = s->name;
+	e->start = s->start;
+	e->dur = now - s->start;
+	e->tid = tid;
+}
+
+/* 
+ * Spans recorded by other threads while we're writing may come out torn, 
+ * that's one bogus span at worst. 
+ */
+void trace_write()
+{
+	uint64_t end = head;
+	uint64_t begin = (end > TRACE_RING_SIZE) ? end - TRACE_RING_SIZE : 0;
+	uint64_t i;
+	int pid = getpid();
+
+	FILE *f = fopen(TRACE_FILENAME, "w");
+	if (!f) {
+		LOG_WARNING("failed to open %s for writing", TRACE_FILENAME);
+		return;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (i = begin; i < end; ++i) {
+		struct trace_event *e = &ring[i & (TRACE_RING_SIZE - 1)];
+		fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+			   "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}%s\n",
+			e->name, pid, e->tid,
+			(unsigned long long)(e->start / 1000),
+			(unsigned long long)(e->start % 1000),
+			(unsigned long long)(e->dur / 1000),
+			(unsigned long long)(e->dur % 1000),
+			(i + 1 < end) ? "," : "");
+	}
+	fprintf(f, "]}\n");
+	fclose(f);
+
+	LOG_MESSAGE("trace: %llu spans written to %s", 
+			(unsigned long long)(end - begin), TRACE_FILENAME);
+}
+
+#else /* WITH_TRACE */
+
+void trace_write()
+{
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_TRACE_H
+#define BMPANEL_TRACE_H
+
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Span tracing of the event and render pipeline, compiled in with 
+ * --with-trace. Spans go to an in-memory ring holding the last 
+ * TRACE_RING_SIZE of them, trace_write() dumps the ring to TRACE_FILENAME as 
+ * Chrome trace JSON (chrome://tracing, ui.perfetto.dev). The panel does that 
+ * on SIGUSR2 and at exit.
+ *
+ *	TRACE_SCOPE("render_taskbar");
+ *
+ * records a span from that line to the end of the enclosing block. Only the 
+ * name pointer is stored, so it must be a string literal. Any thread may 
+ * record, spans are tagged with the thread id.
+ *
+ * Without --with-trace TRACE_SCOPE expands to nothing and trace_write() does 
+ * nothing.
+ */
+
+#define TRACE_RING_SIZE (1 << 16)
+#define TRACE_FILENAME "trace-bmpanel.json"
+
+#if defined(WITH_TRACE)
+
+struct trace_scope {
+	const char *name;
+	uint64_t start;
+};
+
+struct trace_scope trace_scope_begin(const char *name);
+void trace_scope_end(struct trace_scope *s);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+	struct trace_scope TRACE_CONCAT(trace_scope_, __LINE__) \
+		__attribute__((cleanup(trace_scope_end))) = trace_scope_begin(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif
+
+void trace_write();
+
+#endif
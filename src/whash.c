@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <string.h>
+#include "whash.h"
+
+#define WHASH_MIN_SIZE 64
+
+static uint hash_window(Window w)
+{
+	/* XIDs are mostly sequential within a client, mix them a bit */
+	uint32_t x = (uint32_t)w;
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+static void insert_entry(struct whash *h, Window key, void *value)
+{
+	uint mask = h->size - 1;
+	uint i = hash_window(key) & mask;
+
+	while (h->entries[i].key && h->entries[i].key != key)
+		i = (i + 1) & mask;
+
+	if (!h->entries[i].key)
+		h->count++;
+	h->entries[i].key = key;
+	h->entries[i].value = value;
+}
+
+static void resize(struct whash *h, uint size)
+{
+	struct whash_entry *old = h->entries;
+	uint oldsize = h->size;
+	uint i;
+
+	h->entries = XMALLOCZ(struct whash_entry, size);
+	h->size = size;
+	h->count = 0;
+
+	for (i = 0; i < oldsize; ++i) {
+		if (old[i].key)
+			insert_entry(h, old[i].key, old[i].value);
+	}
+	if (old)
+		xfree(old);
+}
+
+void whash_init(struct whash *h)
+{
+	h->entries = 0;
+	h->size = 0;
+	h->count = 0;
+	resize(h, WHASH_MIN_SIZE);
+}
+
+void whash_free(struct whash *h)
+{
+	if (h->entries)
+		xfree(h->entries);
+	h->entries = 0;
+	h->size = 0;
+	h->count = 0;
+}
+
+void *whash_get(struct whash *h, Window key)
+{
+	uint mask = h->size - 1;
+	uint i = hash_window(key) & mask;
+
+	if (!key)
+		return 0;
+
+	while (h->entries[i].key) {
+		if (h->entries[i].key == key)
+			return h->entries[i].value;
+		i = (i + 1) & mask;
+	}
+	return 0;
+}
+
+void whash_put(struct whash *h, Window key, void *value)
+{
+	if (!key)
+		return;
+
+	/* keep load factor under 1/2 */
+	if ((h->count + 1) * 2 > h->size)
+		resize(h, h->size * 2);
+	insert_entry(h, key, value);
+}
+
+void whash_del(struct whash *h, Window key)
+{
+	uint mask = h->size - 1;
+	uint i = hash_window(key) & mask;
+	uint j, k;
+
+	if (!key)
+		return;
+
+	while (h->entries[i].key != key) {
+		if (!h->entries[i].key)
+			return;
+		i = (i + 1) & mask;
+	}
+
+	/* backward shift deletion, no tombstones needed */
+	j = i;
+	for (;;) {
+		h->entries[i].key = 0;
+		h->entries[i].value = 0;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (!h->entries[j].key) {
+				h->count--;
+				return;
+			}
+			k = hash_window(h->entries[j].key) & mask;
+			/* can entry at j be moved to i? (k is not cyclically in (i, j]) */
+			if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+				continue;
+			break;
+		}
+		h->entries[i] = h->entries[j];
+		i = j;
+	}
+}
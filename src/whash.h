@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_WHASH_H
+#define BMPANEL_WHASH_H
+
+#include <X11/X.h>
+#include "common.h"
+
+/* 
+ * Window -> pointer map, open addressing with linear probing. Window 'None'
+ * (zero) marks an empty slot, so it can't be used as a key.
+ */
+
+struct whash_entry {
+	Window key;
+	void *value;
+};
+
+struct whash {
+	struct whash_entry *entries;
+	uint size; /* always power of two */
+	uint count;
+};
+
+void whash_init(struct whash *h);
+void whash_free(struct whash *h);
+void *whash_get(struct whash *h, Window key);
+void whash_put(struct whash *h, Window key, void *value);
+void whash_del(struct whash *h, Window key);
+
+#endif
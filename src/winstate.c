@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <X11/Xutil.h>
+#include "bmpanel.h"
+#include "winstate.h"
+
+static Atom *atoms;
+
+static const struct {
+	uint atom;
+	uint bit;
+} net_states[] = {
+	{XATOM_NET_WM_STATE_SKIP_TASKBAR, WINSTATE_SKIP_TASKBAR},
+	{XATOM_NET_WM_STATE_SKIP_PAGER, WINSTATE_SKIP_PAGER},
+	{XATOM_NET_WM_STATE_HIDDEN, WINSTATE_HIDDEN},
+	{XATOM_NET_WM_STATE_SHADED, WINSTATE_SHADED},
+	{XATOM_NET_WM_STATE_DEMANDS_ATTENTION, WINSTATE_DEMANDS_ATTENTION},
+	{XATOM_NET_WM_STATE_FULLSCREEN, WINSTATE_FULLSCREEN},
+	{XATOM_NET_WM_STATE_MAXIMIZED_VERT, WINSTATE_MAXIMIZED_VERT},
+	{XATOM_NET_WM_STATE_MAXIMIZED_HORZ, WINSTATE_MAXIMIZED_HORZ},
+	{XATOM_NET_WM_STATE_ABOVE, WINSTATE_ABOVE},
+	{XATOM_NET_WM_STATE_BELOW, WINSTATE_BELOW},
+	{XATOM_NET_WM_STATE_STICKY, WINSTATE_STICKY},
+	{XATOM_NET_WM_STATE_MODAL, WINSTATE_MODAL}
+};
+
+void winstate_init(Atom *xatoms)
+{
+	atoms = xatoms;
+}
+
+uint winstate_decode_net(struct xprop *netwmstate)
+{
+	uint ret = 0, i;
+	int num;
+	uint32_t *data = xprop_data(netwmstate, &num);
+
+	while (data && num) {
+		num--;
+		for (i = 0; i < ARRAY_LENGTH(net_states); ++i) {
+			if (data[num] == atoms[net_states[i].atom]) {
+				ret |= net_states[i].bit;
+				break;
+			}
+		}
+	}
+	return ret;
+}
+
+uint winstate_decode_wm(struct xprop *wmstate)
+{
+	uint32_t *data = xprop_data(wmstate, 0);
+	if (data && data[0] == IconicState)
+		return WINSTATE_ICONIC;
+	return 0;
+}
+
+uint winstate_decode_type(struct xprop *type)
+{
+	/* types are in order of preference, the first one is what we go with */
+	uint32_t *data = xprop_data(type, 0);
+	if (!data)
+		return 0;
+	if (*data == atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK])
+		return WINSTATE_TYPE_DOCK;
+	if (*data == atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP])
+		return WINSTATE_TYPE_DESKTOP;
+	return 0;
+}
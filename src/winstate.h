@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_WINSTATE_H
+#define BMPANEL_WINSTATE_H
+
+#include <X11/Xlib.h>
+#include "common.h"
+#include "xprop.h"
+
+/*
+ * Window state as a bitmask. Bits come from three properties, each one is 
+ * decoded on its own, so a change of one property means fetching only that 
+ * property and replacing its group of bits.
+ */
+
+enum {
+	/* _NET_WM_STATE */
+	WINSTATE_SKIP_TASKBAR		= 1 << 0,
+	WINSTATE_SKIP_PAGER		= 1 << 1,
+	WINSTATE_HIDDEN			= 1 << 2,
+	WINSTATE_SHADED			= 1 << 3,
+	WINSTATE_DEMANDS_ATTENTION	= 1 << 4,
+	WINSTATE_FULLSCREEN		= 1 << 5,
+	WINSTATE_MAXIMIZED_VERT		= 1 << 6,
+	WINSTATE_MAXIMIZED_HORZ		= 1 << 7,
+	WINSTATE_ABOVE			= 1 << 8,
+	WINSTATE_BELOW			= 1 << 9,
+	WINSTATE_STICKY			= 1 << 10,
+	WINSTATE_MODAL			= 1 << 11,
+	WINSTATE_NET_MASK		= (1 << 12) - 1,
+
+	/* WM_STATE */
+	WINSTATE_ICONIC			= 1 << 12,
+	WINSTATE_WM_MASK		= WINSTATE_ICONIC,
+
+	/* _NET_WM_WINDOW_TYPE */
+	WINSTATE_TYPE_DOCK		= 1 << 13,
+	WINSTATE_TYPE_DESKTOP		= 1 << 14,
+	WINSTATE_TYPE_MASK		= WINSTATE_TYPE_DOCK | WINSTATE_TYPE_DESKTOP
+};
+
+/* 'atoms' is the XATOM_* table from bmpanel.h */
+void winstate_init(Atom *atoms);
+
+uint winstate_decode_net(struct xprop *netwmstate);
+uint winstate_decode_wm(struct xprop *wmstate);
+uint winstate_decode_type(struct xprop *type);
+
+/* window doesn't want to be on the taskbar */
+#define WINSTATE_IS_HIDDEN(s) \
+	((s) & (WINSTATE_SKIP_TASKBAR | WINSTATE_TYPE_DOCK | WINSTATE_TYPE_DESKTOP))
+#define WINSTATE_IS_ICONIFIED(s) ((s) & (WINSTATE_ICONIC | WINSTATE_HIDDEN))
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include <string.h>
+#include <X11/Xlib-xcb.h>
+#include "logger.h"
+#include "xprop.h"
+#include "replay.h"
+#include "perf.h"
+#include "trace.h"
+
+static xcb_connection_t *conn;
+
+void xprop_init(Display *dpy)
+{
+	conn = XGetXCBConnection(dpy);
+	if (!conn)
+		LOG_ERROR("failed to get XCB connection from Xlib display");
+}
+
+void xprop_request(struct xprop *p, Window win, Atom prop, Atom type)
+{
+	xprop_request_range(p, win, prop, type, 0, 0x7fffffff);
+}
+
+void xprop_request_range(struct xprop *p, Window win, Atom prop, Atom type,
+		uint32_t offset, uint32_t length)
+{
+	PERF_COUNT_MT(PERF_PROP_FETCHES);
+	p->win = win;
+	p->prop = prop;
+	p->type = type;
+	p->offset = offset;
+
+	if (replay_active()) {
+		p->reply = replay_lookup(win, prop, type, offset, length);
+		p->pending = 0;
+		return;
+	}
+
+	/* offset and length are in 32 bit units, like in XGetWindowProperty */
+	p->cookie = xcb_get_property_unchecked(conn, 0, win, prop, type, offset, length);
+	p->reply = 0;
+	p->pending = 1;
+}
+
+static void wait_reply(struct xprop *p)
+{
+	/* the only place we may wait for the server */
+	TRACE_SCOPE("xprop_reply");
+	p->reply = xcb_get_property_reply(conn, p->cookie, 0);
+	p->pending = 0;
+	if (replay_recording())
+		replay_record_prop(p->win, p->prop, p->type, p->offset, p->reply);
+}
+
+void *xprop_data(struct xprop *p, int *items)
+{
+	if (items)
+		*items = 0;
+
+	if (p->pending)
+		wait_reply(p);
+
+	if (!p->reply || p->reply->type == XCB_NONE || !p->reply->value_len)
+		return 0;
+
+	if (items)
+		*items = p->reply->value_len;
+	return xcb_get_property_value(p->reply);
+}
+
+char *xprop_strdup(struct xprop *p)
+{
+	int len;
+	char *data = xprop_data(p, &len);
+	char *ret;
+
+	if (!data)
+		return 0;
+
+	ret = xmalloc(len + 1);
+	memcpy(ret, data, len);
+	ret[len] = '\0';
+	return ret;
+}
+
+uint32_t xprop_bytes_after(struct xprop *p)
+{
+	if (p->pending)
+		wait_reply(p);
+	return p->reply ? p->reply->bytes_after : 0;
+}
+
+void xprop_release(struct xprop *p)
+{
+	if (p->pending)
+		xcb_discard_reply(conn, p->cookie.sequence);
+	if (p->reply)
+		free(p->reply);
+	p->reply = 0;
+	p->pending = 0;
+}
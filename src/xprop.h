@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_XPROP_H
+#define BMPANEL_XPROP_H
+
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+#include "common.h"
+
+/*
+ * Asynchronous window property fetching (XCB through the Xlib/XCB bridge).
+ *
+ * xprop_request() only queues a request, the reply is waited for on the 
+ * first xprop_data() call. Request everything you need first and collect 
+ * replies after that, and N properties will cost one round trip instead 
+ * of N.
+ *
+ * Unlike XGetWindowProperty(), 32 bit items are returned as they are 
+ * (uint32_t), not expanded to longs. Strings are not null-terminated.
+ */
+
+struct xprop {
+	xcb_get_property_cookie_t cookie;
+	xcb_get_property_reply_t *reply;
+	uint pending;
+
+	/* the request, for recording (see replay.h) */
+	Window win;
+	Atom prop;
+	Atom type;
+	uint32_t offset;
+};
+
+void xprop_init(Display *dpy);
+
+void xprop_request(struct xprop *p, Window win, Atom prop, Atom type);
+void xprop_request_range(struct xprop *p, Window win, Atom prop, Atom type,
+		uint32_t offset, uint32_t length);
+
+void *xprop_data(struct xprop *p, int *items);
+char *xprop_strdup(struct xprop *p);
+/* how much of the property is left past the requested range */
+uint32_t xprop_bytes_after(struct xprop *p);
+void xprop_release(struct xprop *p);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#include "logger.h"
+#include "xrender.h"
+
+#if defined(WITH_XRENDER)
+
+#include <stdint.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+#include "whash.h"
+
+static Display *dpy;
+static Visual *vis;
+static Drawable win;
+static int width;
+static int height;
+
+static XRenderPictFormat *argbfmt;
+static XRenderPictFormat *winfmt;
+static XRenderPictFormat *rootfmt;
+
+static GC gc32;
+static GC wingc;
+
+/* backbuffer (ARGB) and presented image (window format) */
+static Pixmap bbpix;
+static Picture bbpic;
+static Pixmap colpix;
+static Picture colpic;
+static Picture winpic;
+
+static Pixmap currootpmap;
+static Picture rootpic;
+
+/* 
+ * Uploaded images, keyed by Imlib_Image. whash is made for Windows, but 
+ * any non-zero pointer sized key works there as well.
+ */
+static struct whash pictures;
+
+#define IMAGE_KEY(img) ((Window)(uintptr_t)(img))
+
+static Picture upload_image(Imlib_Image img)
+{
+	static const uint32_t one = 1;
+	int w, h, i, alpha;
+	uint32_t *src, *buf;
+	XImage *xi;
+	Pixmap pix;
+	Picture pic;
+	XRenderPictureAttributes pa;
+
+	imlib_context_set_image(img);
+	w = imlib_image_get_width();
+	h = imlib_image_get_height();
+	alpha = imlib_image_has_alpha();
+	src = imlib_image_get_data_for_reading_only();
+
+	/* render wants premultiplied alpha, imlib doesn't */
+	buf = XMALLOC(uint32_t, w * h);
+	for (i = 0; i < w * h; ++i) {
+		uint32_t p = src[i];
+		uint32_t a = alpha ? p >> 24 : 0xff;
+		uint32_t r = ((p >> 16) & 0xff) * a / 0xff;
+		uint32_t g = ((p >> 8) & 0xff) * a / 0xff;
+		uint32_t b = (p & 0xff) * a / 0xff;
+		buf[i] = (a << 24) | (r << 16) | (g << 8) | b;
+	}
+
+	xi = XCreateImage(dpy, vis, 32, ZPixmap, 0, (char*)buf, w, h, 32, 0);
+	xi->byte_order = *(const uchar*)&one ? LSBFirst : MSBFirst;
+
+	pix = XCreatePixmap(dpy, win, w, h, 32);
+	if (!gc32)
+		gc32 = XCreateGC(dpy, pix, 0, 0);
+	XPutImage(dpy, pix, gc32, xi, 0, 0, 0, 0, w, h);
+	xi->data = 0;
+	XDestroyImage(xi);
+	xfree(buf);
+
+	/* repeat doesn't hurt non-tiles, they are never drawn past their size */
+	pa.repeat = RepeatNormal;
+	pic = XRenderCreatePicture(dpy, pix, argbfmt, CPRepeat, &pa);
+	XFreePixmap(dpy, pix);
+	return pic;
+}
+
+static Picture get_picture(Imlib_Image img)
+{
+	Picture pic = (Picture)(uintptr_t)whash_get(&pictures, IMAGE_KEY(img));
+	if (!pic) {
+		pic = upload_image(img);
+		whash_put(&pictures, IMAGE_KEY(img), (void*)(uintptr_t)pic);
+	}
+	return pic;
+}
+
+int xr_init(Display *d, Visual *v, int depth, Drawable w, int wd, int ht)
+{
+	int eventb, errorb;
+	XRenderPictureAttributes pa;
+
+	dpy = d;
+	vis = v;
+	win = w;
+	width = wd;
+	height = ht;
+
+	if (!XRenderQueryExtension(dpy, &eventb, &errorb)) {
+		LOG_INFO("xrender: extension is not available, using client-side rendering");
+		return 0;
+	}
+
+	argbfmt = XRenderFindStandardFormat(dpy, PictStandardARGB32);
+	winfmt = XRenderFindVisualFormat(dpy, vis);
+	rootfmt = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, DefaultScreen(dpy)));
+	if (!argbfmt || !winfmt || !rootfmt) {
+		LOG_INFO("xrender: picture formats not found, using client-side rendering");
+		return 0;
+	}
+
+	whash_init(&pictures);
+
+	bbpix = XCreatePixmap(dpy, win, width, height, 32);
+	bbpic = XRenderCreatePicture(dpy, bbpix, argbfmt, 0, 0);
+	colpix = XCreatePixmap(dpy, win, width, height, depth);
+	colpic = XRenderCreatePicture(dpy, colpix, winfmt, 0, 0);
+	pa.subwindow_mode = IncludeInferiors;
+	winpic = XRenderCreatePicture(dpy, win, winfmt, CPSubwindowMode, &pa);
+	wingc = XCreateGC(dpy, win, 0, 0);
+
+	xr_set_clip(0, 0, width, height);
+	LOG_INFO("xrender: using server-side rendering");
+	return 1;
+}
+
+void xr_shutdown()
+{
+	uint i;
+
+	for (i = 0; i < pictures.size; ++i) {
+		if (pictures.entries[i].key)
+			XRenderFreePicture(dpy, (Picture)(uintptr_t)pictures.entries[i].value);
+	}
+	whash_free(&pictures);
+
+	if (rootpic)
+		XRenderFreePicture(dpy, rootpic);
+	XRenderFreePicture(dpy, winpic);
+	XRenderFreePicture(dpy, colpic);
+	XRenderFreePicture(dpy, bbpic);
+	XFreePixmap(dpy, colpix);
+	XFreePixmap(dpy, bbpix);
+	XFreeGC(dpy, wingc);
+	if (gc32)
+		XFreeGC(dpy, gc32);
+	rootpic = 0;
+	gc32 = 0;
+}
+
+void xr_draw_image(Imlib_Image img, int sx, int sy, int dx, int dy, int w, int h, int blend)
+{
+	if (!img)
+		return;
+	XRenderComposite(dpy, blend ? PictOpOver : PictOpSrc,
+			 get_picture(img), None, bbpic,
+			 sx, sy, 0, 0, dx, dy, w, h);
+}
+
+void xr_tile_image(Imlib_Image img, int x, int y, int w, int h)
+{
+	if (!img)
+		return;
+	/* source picture repeats, one request fills any width */
+	XRenderComposite(dpy, PictOpSrc, get_picture(img), None, bbpic,
+			 0, 0, 0, 0, x, y, w, h);
+}
+
+void xr_forget_image(Imlib_Image img)
+{
+	Picture pic = (Picture)(uintptr_t)whash_get(&pictures, IMAGE_KEY(img));
+	if (pic) {
+		XRenderFreePicture(dpy, pic);
+		whash_del(&pictures, IMAGE_KEY(img));
+	}
+}
+
+void xr_set_clip(int x, int y, int w, int h)
+{
+	XRectangle r = {x, y, w, h};
+	XRenderSetPictureClipRectangles(dpy, bbpic, 0, 0, &r, 1);
+}
+
+void xr_present(Pixmap rootpmap, int bgx, int bgy, int x, int w)
+{
+	if (rootpmap) {
+		if (rootpmap != currootpmap) {
+			if (rootpic)
+				XRenderFreePicture(dpy, rootpic);
+			rootpic = XRenderCreatePicture(dpy, rootpmap, rootfmt, 0, 0);
+			currootpmap = rootpmap;
+		}
+		XRenderComposite(dpy, PictOpSrc, rootpic, None, colpic,
+				 bgx + x, bgy, 0, 0, x, 0, w, height);
+		XRenderComposite(dpy, PictOpOver, bbpic, None, colpic,
+				 x, 0, 0, 0, x, 0, w, height);
+		XCopyArea(dpy, colpix, win, wingc, x, 0, w, height, x, 0);
+	} else {
+		XRenderComposite(dpy, PictOpSrc, bbpic, None, winpic,
+				 x, 0, 0, 0, x, 0, w, height);
+	}
+}
+
+#else
+
+int xr_init(Display *dpy, Visual *vis, int depth, Drawable win, int w, int h)
+{
+	return 0;
+}
+
+void xr_shutdown()
+{
+}
+
+void xr_draw_image(Imlib_Image img, int sx, int sy, int dx, int dy, int w, int h, int blend)
+{
+}
+
+void xr_tile_image(Imlib_Image img, int x, int y, int w, int h)
+{
+}
+
+void xr_forget_image(Imlib_Image img)
+{
+}
+
+void xr_set_clip(int x, int y, int w, int h)
+{
+}
+
+void xr_present(Pixmap rootpmap, int bgx, int bgy, int x, int w)
+{
+}
+
+#endif
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+#ifndef BMPANEL_XRENDER_H
+#define BMPANEL_XRENDER_H
+
+#include <X11/Xlib.h>
+#include <Imlib2.h>
+#include "common.h"
+
+/*
+ * Server-side composition through XRender. Every Imlib image which is drawn
+ * (theme parts, icons, text) is uploaded once as a Picture and cached, 
+ * the backbuffer is a server pixmap. Per frame only composite requests go 
+ * through the wire, which makes a difference on remote X.
+ *
+ * Images must be forgotten with xr_forget_image() before they are freed.
+ * Compiled in with --with-xrender, without it xr_init() always fails.
+ */
+
+int xr_init(Display *dpy, Visual *vis, int depth, Drawable win, int w, int h);
+void xr_shutdown();
+
+void xr_draw_image(Imlib_Image img, int sx, int sy, int dx, int dy, int w, int h, int blend);
+void xr_tile_image(Imlib_Image img, int x, int y, int w, int h);
+void xr_forget_image(Imlib_Image img);
+void xr_set_clip(int x, int y, int w, int h);
+void xr_present(Pixmap rootpmap, int bgx, int bgy, int x, int w);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+/* 
+ * Icon downscaling: every kernel of src/iconscale.c against the Imlib2 path 
+ * it replaced (copy the icon into an image, imlib_create_cropped_scaled_image), 
+ * for 16, 32, 48 and 256 pixel sources. Also checks that all kernels produce 
+ * the same pixels. Usage: iconscale_bench [icon size, default 16] 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <Imlib2.h>
+#include "logger.h"
+#include "iconscale.h"
+
+static const int sizes[] = {16, 32, 48, 256};
+static const char *kernels[] = {"avx2", "sse2", "scalar"};
+
+/* about 20M source pixels per measurement */
+#define PIXELS_PER_RUN (20 * 1000 * 1000)
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* something icon-like: a gradient with a soft transparent border */
+static void fill_icon(uint32_t *p, int size)
+{
+	int x, y;
+	for (y = 0; y < size; ++y) {
+		for (x = 0; x < size; ++x) {
+			int edge = x < y ? x : y;
+			if (size - 1 - x < edge) edge = size - 1 - x;
+			if (size - 1 - y < edge) edge = size - 1 - y;
+			uint32_t a = edge * 4 * 255 / size;
+			if (a > 255) a = 255;
+			*p++ = a << 24 | (x * 255 / size) << 16 |
+				(y * 255 / size) << 8 | ((x ^ y) & 0xFF);
+		}
+	}
+}
+
+static double per_icon_ns(uint64_t start, int runs)
+{
+	return (double)(now_ns() - start) / runs;
+}
+
+static double bench_imlib(const uint32_t *src, int size, int iconsize, int runs)
+{
+	int i;
+	uint64_t start = now_ns();
+	for (i = 0; i < runs; ++i) {
+		Imlib_Image img = imlib_create_image_using_copied_data(size, size, (DATA32*)src);
+		imlib_context_set_image(img);
+		imlib_image_set_has_alpha(1);
+		Imlib_Image scaled = imlib_create_cropped_scaled_image(0, 0, size, size, 
+				iconsize, iconsize);
+		imlib_free_image();
+		imlib_context_set_image(scaled);
+		imlib_free_image();
+	}
+	return per_icon_ns(start, runs);
+}
+
+static double bench_kernel(const uint32_t *src, int size, int iconsize, int runs)
+{
+	int i;
+	uint64_t start = now_ns();
+	for (i = 0; i < runs; ++i) {
+		Imlib_Image img = imlib_create_image(iconsize, iconsize);
+		imlib_context_set_image(img);
+		imlib_image_set_has_alpha(1);
+		DATA32 *dst = imlib_image_get_data();
+		icon_downscale(src, size, size, dst, iconsize, iconsize);
+		imlib_image_put_back_data(dst);
+		imlib_free_image();
+	}
+	return per_icon_ns(start, runs);
+}
+
+int main(int argc, char **argv)
+{
+	int iconsize = 16;
+	int s, k, failed = 0;
+	const char *best = icon_downscale_kernel();
+
+	log_attach_callback(log_console_callback);
+	if (argc > 1)
+		iconsize = atoi(argv[1]);
+	if (iconsize <= 0) {
+		fprintf(stderr, "usage: %s [icon size]\n", argv[0]);
+		return 1;
+	}
+	imlib_set_cache_size(0);
+	imlib_context_set_anti_alias(1);
+
+	printf("icon size %d, runtime kernel: %s\n", iconsize, best);
+	for (s = 0; s < ARRAY_LENGTH(sizes); ++s) {
+		int size = sizes[s];
+		if (size < iconsize)
+			continue;
+
+		int runs = PIXELS_PER_RUN / (size * size);
+		uint32_t *src = xmalloc(sizeof(uint32_t) * size * size);
+		uint32_t *ref = xmalloc(sizeof(uint32_t) * iconsize * iconsize);
+		uint32_t *out = xmalloc(sizeof(uint32_t) * iconsize * iconsize);
+		fill_icon(src, size);
+
+		printf("%4dpx  %-8s %9.0f ns/icon\n", size, "imlib", 
+			bench_imlib(src, size, iconsize, runs));
+
+		icon_downscale_use("scalar");
+		icon_downscale(src, size, size, ref, iconsize, iconsize);
+		for (k = 0; k < ARRAY_LENGTH(kernels); ++k) {
+			if (icon_downscale_use(kernels[k]) < 0) {
+				printf("%4dpx  %-8s unsupported by this CPU\n", size, kernels[k]);
+				continue;
+			}
+			icon_downscale(src, size, size, out, iconsize, iconsize);
+			if (memcmp(ref, out, sizeof(uint32_t) * iconsize * iconsize)) {
+				printf("%4dpx  %-8s output differs from scalar\n", size, kernels[k]);
+				failed = 1;
+			}
+			printf("%4dpx  %-8s %9.0f ns/icon\n", size, kernels[k], 
+				bench_kernel(src, size, iconsize, runs));
+		}
+		icon_downscale_use(best);
+
+		xfree(src);
+		xfree(ref);
+		xfree(out);
+	}
+	return failed;
+}
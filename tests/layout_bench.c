@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+/* 
+ * Panel layout with 10k synthetic task buttons (src/layout.c): arrange the 
+ * elements and place every button. Cases: nothing moved, a task added or 
+ * removed each pass (every button resizes), the same with the button width 
+ * unchanged (only the last button resizes), and the switcher (left of the 
+ * taskbar) resizing each pass, which moves every button. Checks that the 
+ * buttons tile the taskbar exactly. Usage: layout_bench [tasks] 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "logger.h"
+#include "layout.h"
+
+#define PASSES 1000
+#define BUTTON_WIDTH 40
+#define SEPARATOR 2
+
+static struct layout lay;
+static struct layout_box *boxes;
+static int failed;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* one relayout like update_taskbar_positions does it, returns boxes changed */
+static int pass(int count)
+{
+	struct layout_row row;
+	int i, changed = 0;
+
+	layout_arrange(&lay);
+	layout_row_init(&row, count, lay.taskbar.x, lay.taskbar.w, SEPARATOR);
+	for (i = 0; i < count; ++i)
+		changed += layout_row_place(&row, i, &boxes[i]);
+	return changed;
+}
+
+static void verify(int count)
+{
+	int i;
+	for (i = 1; i < count; ++i) {
+		if (boxes[i].x != boxes[i-1].x + boxes[i-1].w + SEPARATOR) {
+			printf("FAIL: button %d at %d, previous ends at %d\n", 
+				i, boxes[i].x, boxes[i-1].x + boxes[i-1].w);
+			failed = 1;
+			return;
+		}
+	}
+	if (boxes[count-1].x + boxes[count-1].w != lay.taskbar.x + lay.taskbar.w) {
+		printf("FAIL: last button doesn't reach the end of the taskbar\n");
+		failed = 1;
+	}
+}
+
+static void report(const char *what, uint64_t start, int count, long changed)
+{
+	uint64_t ns = (now_ns() - start) / PASSES;
+	printf("%-16s %8llu ns/pass  %6.2f ns/task  %7ld boxes changed/pass\n",
+		what, (unsigned long long)ns, (double)ns / count, changed / PASSES);
+}
+
+int main(int argc, char **argv)
+{
+	int tasks = 10000;
+	int i;
+	long changed;
+	uint64_t start;
+
+	log_attach_callback(log_console_callback);
+	if (argc > 1)
+		tasks = atoi(argv[1]);
+	if (tasks <= 0) {
+		fprintf(stderr, "usage: %s [tasks]\n", argv[0]);
+		return 1;
+	}
+
+	/* 
+	 * A fixed panel, its taskbar fits exactly 'tasks' buttons of 
+	 * BUTTON_WIDTH. One task more makes every button a pixel narrower, one 
+	 * less leaves the width as is and only the last button changes. 
+	 */
+	boxes = xmallocz(sizeof(struct layout_box) * (tasks + 1));
+	layout_init(&lay, "sbtc", tasks * (BUTTON_WIDTH + SEPARATOR) + 
+			120 + 48 + 60 + 3 * SEPARATOR, SEPARATOR);
+	lay.switcher.w = 120;
+	lay.tray.w = 48;
+	lay.clock.w = 60;
+	pass(tasks);
+	verify(tasks);
+
+	printf("%d tasks, %d passes\n", tasks, PASSES);
+
+	changed = 0;
+	start = now_ns();
+	for (i = 0; i < PASSES; ++i)
+		changed += pass(tasks);
+	report("nothing moved", start, tasks, changed);
+	verify(tasks);
+
+	changed = 0;
+	start = now_ns();
+	for (i = 0; i < PASSES; ++i)
+		changed += pass(tasks + (i & 1));
+	report("task add/remove", start, tasks, changed);
+	verify(tasks + ((PASSES - 1) & 1));
+
+	/* best case, buttons keep their width */
+	pass(tasks);
+	changed = 0;
+	start = now_ns();
+	for (i = 0; i < PASSES; ++i)
+		changed += pass(tasks - 1 + (i & 1));
+	report("same width", start, tasks, changed);
+	verify(tasks - 1 + ((PASSES - 1) & 1));
+
+	changed = 0;
+	start = now_ns();
+	for (i = 0; i < PASSES; ++i) {
+		lay.switcher.w = 120 + (i & 1) * 30;
+		changed += pass(tasks);
+	}
+	report("switcher resize", start, tasks, changed);
+	verify(tasks);
+
+	xfree(boxes);
+	return failed;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+/* 
+ * Dispatch latency of src/reactor.c: time from an eventfd write to its 
+ * callback and from a timerfd deadline to its callback, both through 
+ * reactor_run. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "logger.h"
+#include "reactor.h"
+
+#define EVENT_ROUNDS 100000
+#define TIMER_ROUNDS 2000
+#define TIMER_DELAY_NS (200 * 1000)
+
+static uint64_t samples[EVENT_ROUNDS];
+static int nsamples;
+static int rounds;
+static uint64_t start;
+static int efd;
+static struct reactor_watch *timer;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void report(const char *what)
+{
+	uint64_t sum = 0;
+	int i;
+
+	qsort(samples, nsamples, sizeof(uint64_t), cmp_u64);
+	for (i = 0; i < nsamples; ++i)
+		sum += samples[i];
+	printf("%-20s n=%-6d min %6llu  avg %6llu  p50 %6llu  p99 %6llu  max %8llu ns\n",
+		what, nsamples,
+		(unsigned long long)samples[0],
+		(unsigned long long)(sum / nsamples),
+		(unsigned long long)samples[nsamples / 2],
+		(unsigned long long)samples[nsamples * 99 / 100],
+		(unsigned long long)samples[nsamples - 1]);
+}
+
+/****************************************************************************
+  eventfd -> callback
+****************************************************************************/
+
+static void kick()
+{
+	uint64_t one = 1;
+	start = now_ns();
+	if (write(efd, &one, sizeof(one)) != sizeof(one)) {
+		perror("write");
+		exit(1);
+	}
+}
+
+static void event_cb(int fd, uint events, void *arg)
+{
+	uint64_t v;
+	uint64_t t = now_ns();
+
+	if (read(fd, &v, sizeof(v)) != sizeof(v))
+		return;
+	samples[nsamples++] = t - start;
+	if (++rounds == EVENT_ROUNDS) {
+		reactor_quit();
+		return;
+	}
+	kick();
+}
+
+/****************************************************************************
+  timerfd -> callback
+****************************************************************************/
+
+static void arm()
+{
+	struct itimerspec ts;
+
+	start = now_ns() + TIMER_DELAY_NS;
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_sec = start / 1000000000;
+	ts.it_value.tv_nsec = start % 1000000000;
+	reactor_set_timer(timer, REACTOR_TIMER_ABS, &ts);
+}
+
+static void timer_cb(uint64_t expirations, void *arg)
+{
+	samples[nsamples++] = now_ns() - start;
+	if (++rounds == TIMER_ROUNDS) {
+		reactor_quit();
+		return;
+	}
+	arm();
+}
+
+int main(int argc, char **argv)
+{
+	log_attach_callback(log_console_callback);
+	if (reactor_init() != 0)
+		return 1;
+
+	efd = eventfd(0, 0);
+	reactor_add_fd(efd, REACTOR_READ, event_cb, 0);
+	kick();
+	reactor_run();
+	report("eventfd -> callback");
+
+	nsamples = rounds = 0;
+	timer = reactor_add_timer(CLOCK_MONOTONIC, timer_cb, 0);
+	arm();
+	reactor_run();
+	report("timerfd -> callback");
+
+	reactor_shutdown();
+	close(efd);
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2008 nsf
+ */
+
+/* 
+ * Deferred callbacks of src/reactor.c, in particular the frame_cb -> 
+ * xqueue_cb -> frame_cb chain of the panel: a callback deferred again after 
+ * it ran in the current round must run again before the loop sleeps. 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "logger.h"
+#include "reactor.h"
+
+static int failed;
+static int frames;
+static int drains;
+static int queued; /* "events" Xlib queued while we were drawing */
+static int efd;
+
+#define CHECK(what) do { \
+	if (!(what)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #what); \
+		failed = 1; \
+	} \
+} while (0)
+
+static void frame_cb(void *arg);
+
+static void drain_cb(void *arg)
+{
+	drains++;
+	if (queued) {
+		queued = 0;
+		reactor_defer(frame_cb, 0);
+	}
+}
+
+static void frame_cb(void *arg)
+{
+	frames++;
+	if (frames == 1) {
+		/* the first frame pulled more events into the queue */
+		queued = 1;
+		reactor_defer(drain_cb, 0);
+	}
+}
+
+static void wakeup_cb(int fd, uint events, void *arg)
+{
+	uint64_t v;
+	if (read(fd, &v, sizeof(v)) != sizeof(v))
+		return;
+
+	/* duplicates of a pending callback collapse into one */
+	reactor_defer(frame_cb, 0);
+	reactor_defer(frame_cb, 0);
+}
+
+/* runs after everything the wakeup deferred, checks and stops the loop */
+static void check_cb(uint64_t expirations, void *arg)
+{
+	CHECK(frames == 2);
+	CHECK(drains == 1);
+	reactor_quit();
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t one = 1;
+	struct itimerspec ts;
+
+	log_attach_callback(log_console_callback);
+	CHECK(reactor_init() == 0);
+
+	efd = eventfd(0, 0);
+	CHECK(reactor_add_fd(efd, REACTOR_READ, wakeup_cb, 0) != 0);
+
+	struct reactor_watch *t = reactor_add_timer(CLOCK_MONOTONIC, check_cb, 0);
+	CHECK(t != 0);
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_nsec = 50 * 1000 * 1000;
+	reactor_set_timer(t, 0, &ts);
+
+	CHECK(write(efd, &one, sizeof(one)) == sizeof(one));
+	reactor_run();
+
+	reactor_shutdown();
+	close(efd);
+
+	if (!failed)
+		printf("reactor_test: ok\n");
+	return failed;
+}